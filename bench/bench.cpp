@@ -0,0 +1,300 @@
+#include "bench.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include "alloc_counter.hpp"
+#include "gemm.hpp"
+
+namespace {
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()
+    )
+        .count();
+}
+
+std::vector<std::unique_ptr<bench::Benchmark>> &registry() {
+    static std::vector<std::unique_ptr<bench::Benchmark>> res;
+    return res;
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_iter;
+    double allocs_per_iter;
+    std::map<std::string, double> rates;
+    std::map<std::string, double> counters;
+};
+
+std::string run_name(
+    const std::string &name,
+    const std::vector<int64_t> &args
+) {
+    std::string res = name;
+    for (int64_t arg : args) {
+        res += '/';
+        res += std::to_string(arg);
+    }
+    return res;
+}
+
+// Runs with growing iteration counts until a run lasts min_time.
+Result measure(
+    const bench::Benchmark &benchmark,
+    const std::vector<int64_t> &args,
+    double min_time
+) {
+    uint64_t iterations = 1;
+    while (true) {
+        bench::State state(iterations, args);
+        benchmark.function()(state);
+        uint64_t allocs = state.allocations();
+        double elapsed = state.elapsed_ns();
+        if (elapsed >= min_time * 1e9 || iterations >= (uint64_t{1} << 40)) {
+            auto n = static_cast<double>(iterations);
+            Result res{
+                run_name(benchmark.name(), args),
+                iterations,
+                elapsed / n,
+                static_cast<double>(allocs) / n,
+                {},
+                {}
+            };
+            for (const auto &[key, value] : state.rates) {
+                res.rates[key] = value / elapsed * 1e9;
+            }
+            for (const auto &[key, value] : state.counters) {
+                res.counters[key] = value / n;
+            }
+            return res;
+        }
+        // Aim 40% past the minimum time, growing at most 10x per round.
+        double scale = elapsed > 0 ? min_time * 1.4e9 / elapsed : 10;
+        iterations = std::max(
+            iterations + 1,
+            static_cast<uint64_t>(static_cast<double>(iterations) *
+                                  std::min(scale, 10.0))
+        );
+    }
+}
+
+std::string json_escape(const std::string &str) {
+    std::string res;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+        }
+        res += c;
+    }
+    return res;
+}
+
+void write_json(const std::string &path, const std::vector<Result> &results) {
+    std::ofstream file(path);
+    std::time_t time = std::time(nullptr);
+    char date[64];
+    std::strftime(date, sizeof(date), "%FT%T%z", std::localtime(&time));
+    const char *isa[] = {"scalar", "avx2", "avx512"};
+    file << "{\n  \"context\": {\n";
+    file << "    \"date\": \"" << date << "\",\n";
+    file << "    \"gemm_isa\": \""
+         << isa[static_cast<int>(nn::gemm_isa())] << "\"\n";
+    file << "  },\n  \"benchmarks\": [\n";
+    for (size_t it = 0; it < results.size(); ++it) {
+        const Result &res = results[it];
+        file << "    {\n";
+        file << "      \"name\": \"" << json_escape(res.name) << "\",\n";
+        file << "      \"iterations\": " << res.iterations << ",\n";
+        file << "      \"real_time\": " << res.ns_per_iter << ",\n";
+        file << "      \"time_unit\": \"ns\",\n";
+        for (const auto &[key, value] : res.rates) {
+            file << "      \"" << json_escape(key)
+                 << "_per_second\": " << value << ",\n";
+        }
+        for (const auto &[key, value] : res.counters) {
+            file << "      \"" << json_escape(key) << "\": " << value << ",\n";
+        }
+        file << "      \"allocs_per_iter\": " << res.allocs_per_iter << "\n";
+        file << "    }" << (it + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+std::string format_rate(double rate) {
+    const char *units[] = {"", "k", "M", "G"};
+    size_t unit = 0;
+    while (rate >= 1000 && unit < 3) {
+        rate /= 1000;
+        ++unit;
+    }
+    std::ostringstream os;
+    os.precision(3);
+    os << rate << units[unit] << "/s";
+    return os.str();
+}
+
+}  // namespace
+
+namespace bench {
+
+State::State(uint64_t iterations, std::vector<int64_t> args)
+    : iterations_(iterations), args_(std::move(args)) {
+}
+
+int64_t State::range(size_t index) const {
+    return args_.at(index);
+}
+
+uint64_t State::iterations() const {
+    return iterations_;
+}
+
+void State::pause_timing() {
+    elapsed_ += now_ns() - start_;
+    allocations_ += bench::allocations() - allocations_start_;
+}
+
+void State::resume_timing() {
+    allocations_start_ = bench::allocations();
+    start_ = now_ns();
+}
+
+State::Iterator::Iterator(State *state, uint64_t remaining)
+    : state_(state), remaining_(remaining) {
+}
+
+bool State::Iterator::operator!=(const Iterator &other) {
+    if (remaining_ != other.remaining_) {
+        return true;
+    }
+    if (state_ != nullptr) {
+        state_->pause_timing();
+        state_ = nullptr;
+    }
+    return false;
+}
+
+void State::Iterator::operator++() {
+    --remaining_;
+}
+
+State::Tick State::Iterator::operator*() const {
+    return {};
+}
+
+State::Iterator State::begin() {
+    resume_timing();
+    return Iterator(this, iterations_);
+}
+
+State::Iterator State::end() {
+    return Iterator(nullptr, 0);
+}
+
+double State::elapsed_ns() const {
+    return static_cast<double>(elapsed_);
+}
+
+uint64_t State::allocations() const {
+    return allocations_;
+}
+
+Benchmark::Benchmark(std::string name, Function function)
+    : name_(std::move(name)), function_(std::move(function)) {
+}
+
+Benchmark *Benchmark::args(std::vector<int64_t> args) {
+    arg_lists_.push_back(std::move(args));
+    return this;
+}
+
+const std::string &Benchmark::name() const {
+    return name_;
+}
+
+const Function &Benchmark::function() const {
+    return function_;
+}
+
+const std::vector<std::vector<int64_t>> &Benchmark::arg_lists() const {
+    return arg_lists_;
+}
+
+Benchmark *register_benchmark(std::string name, Function function) {
+    registry().push_back(
+        std::make_unique<Benchmark>(std::move(name), std::move(function))
+    );
+    return registry().back().get();
+}
+
+uint64_t allocations() {
+    return nn::heap_allocations();
+}
+
+int run(int argc, char **argv) {
+    std::string filter;
+    std::string json;
+    double min_time = 0.2;
+    for (int it = 1; it < argc; ++it) {
+        std::string arg = argv[it];
+        if (arg.starts_with("--filter=")) {
+            filter = arg.substr(9);
+        } else if (arg.starts_with("--min_time=")) {
+            min_time = std::stod(arg.substr(11));
+        } else if (arg.starts_with("--json=")) {
+            json = arg.substr(7);
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--filter=<substring>] [--min_time=<seconds>]"
+                         " [--json=<path>]\n";
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    std::printf(
+        "%-36s %14s %12s %14s %12s\n", "Benchmark", "ns/iter", "iterations",
+        "rate", "allocs/iter"
+    );
+    for (const auto &benchmark : registry()) {
+        std::vector<std::vector<int64_t>> arg_lists = benchmark->arg_lists();
+        if (arg_lists.empty()) {
+            arg_lists.emplace_back();
+        }
+        for (const auto &args : arg_lists) {
+            if (run_name(benchmark->name(), args).find(filter) ==
+                std::string::npos) {
+                continue;
+            }
+            Result res = measure(*benchmark, args, min_time);
+            std::string rate;
+            for (const auto &[key, value] : res.rates) {
+                rate = format_rate(value) + " " + key;
+            }
+            std::printf(
+                "%-36s %14.1f %12llu %14s %12.1f\n", res.name.c_str(),
+                res.ns_per_iter,
+                static_cast<unsigned long long>(res.iterations), rate.c_str(),
+                res.allocs_per_iter
+            );
+            results.push_back(std::move(res));
+        }
+    }
+    if (!json.empty()) {
+        write_json(json, results);
+    }
+    return 0;
+}
+
+}  // namespace bench
+
+int main(int argc, char **argv) {
+    return bench::run(argc, argv);
+}
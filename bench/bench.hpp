@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+// Measurement loop of one benchmark run, in the style of Google Benchmark:
+//
+//     void BM_op(bench::State &state) {
+//         for (auto _ : state) {
+//             ...
+//         }
+//     }
+//
+// The body runs for a number of iterations chosen so that the run lasts at
+// least the minimum time.
+class State {
+public:
+    State(uint64_t iterations, std::vector<int64_t> args);
+
+    int64_t range(size_t index) const;
+    uint64_t iterations() const;
+    // Work done in the run, reported per second (e.g. "nodes").
+    std::map<std::string, double> rates;
+    // Totals reported per iteration.
+    std::map<std::string, double> counters;
+
+    // Excludes setup from the timing inside the loop.
+    void pause_timing();
+    void resume_timing();
+
+    // Loop variable; user-provided so that an unused one isn't a warning.
+    struct Tick {
+        Tick() {}
+        ~Tick() {}
+    };
+    // Starts the clock on begin() and stops it when the loop ends.
+    class Iterator {
+    public:
+        Iterator(State *state, uint64_t remaining);
+        bool operator!=(const Iterator &other);
+        void operator++();
+        Tick operator*() const;
+
+    private:
+        State *state_;
+        uint64_t remaining_;
+    };
+    Iterator begin();
+    Iterator end();
+
+    double elapsed_ns() const;
+    // Heap allocations made while timing.
+    uint64_t allocations() const;
+
+private:
+    uint64_t iterations_;
+    std::vector<int64_t> args_;
+    int64_t start_ = 0;
+    int64_t elapsed_ = 0;
+    uint64_t allocations_start_ = 0;
+    uint64_t allocations_ = 0;
+};
+
+using Function = std::function<void(State &)>;
+
+// Registered benchmark, run once per argument list.
+class Benchmark {
+public:
+    Benchmark(std::string name, Function function);
+    Benchmark *args(std::vector<int64_t> args);
+
+    const std::string &name() const;
+    const Function &function() const;
+    const std::vector<std::vector<int64_t>> &arg_lists() const;
+
+private:
+    std::string name_;
+    Function function_;
+    std::vector<std::vector<int64_t>> arg_lists_;
+};
+
+Benchmark *register_benchmark(std::string name, Function function);
+
+// Heap allocations made by the process so far.
+uint64_t allocations();
+
+template <typename T>
+void do_not_optimize(const T &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs the benchmarks selected by the command line:
+//   --filter=<substring>  only benchmarks whose name contains it
+//   --min_time=<seconds>  minimum time per run, 0.2 by default
+//   --json=<path>         also writes the results as JSON
+int run(int argc, char **argv);
+
+}  // namespace bench
+
+#define BENCH_CONCAT_(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT_(a, b)
+// Registers fn; argument lists are added with ->args({...}).
+#define BENCHMARK(fn)                                          \
+    [[maybe_unused]] static bench::Benchmark *BENCH_CONCAT( \
+        bench_, __LINE__                                       \
+    ) = bench::register_benchmark(#fn, fn)
@@ -0,0 +1,170 @@
+#include <vector>
+#include "bench.hpp"
+#include "mlp.hpp"
+#include "optim.hpp"
+#include "profile.hpp"
+#include "utils.hpp"
+#include "value.hpp"
+
+using namespace nn;
+
+namespace {
+
+std::vector<Value> make_input(size_t size) {
+    std::vector<Value> res;
+    for (size_t it = 0; it < size; ++it) {
+        res.push_back(make_constant(0.01 * static_cast<double>(it)));
+    }
+    return res;
+}
+
+std::vector<std::vector<Value>> make_batch(size_t batch, size_t size) {
+    std::vector<std::vector<Value>> res;
+    for (size_t it = 0; it < batch; ++it) {
+        res.push_back(make_input(size));
+    }
+    return res;
+}
+
+void BM_neuron_forward(bench::State &state) {
+    auto in = static_cast<size_t>(state.range(0));
+    Neuron neuron(in);
+    std::vector<Value> input = make_input(in);
+    uint64_t nodes = 0;
+    for (auto _ : state) {
+        Tape tape;
+        Value res = neuron(input);
+        bench::do_not_optimize(res);
+        nodes += tape.size();
+    }
+    state.rates["nodes"] = static_cast<double>(nodes);
+}
+BENCHMARK(BM_neuron_forward)->args({16})->args({256});
+
+void BM_layer_forward(bench::State &state) {
+    auto in = static_cast<size_t>(state.range(0));
+    auto out = static_cast<size_t>(state.range(1));
+    Layer layer(in, out);
+    std::vector<Value> input = make_input(in);
+    uint64_t nodes = 0;
+    for (auto _ : state) {
+        Tape tape;
+        std::vector<Value> res = layer(input);
+        bench::do_not_optimize(res);
+        nodes += tape.size();
+    }
+    state.rates["nodes"] = static_cast<double>(nodes);
+}
+BENCHMARK(BM_layer_forward)->args({16, 16})->args({64, 64})->args({256, 256});
+
+// MLP in -> {width, width, 1}; range(2) selects the single-sample graph (0),
+// the fused batched block over 32 samples (1) or graph-free predict (2).
+void BM_mlp_forward(bench::State &state) {
+    auto in = static_cast<size_t>(state.range(0));
+    auto width = static_cast<size_t>(state.range(1));
+    int64_t mode = state.range(2);
+    MLP mlp(in, {width, width, 1});
+    std::vector<std::vector<Value>> X = make_batch(mode == 0 ? 1 : 32, in);
+    std::vector<double> raw(X.size() * in, 0.5);
+    std::vector<double> out(X.size());
+    uint64_t nodes = 0;
+    for (auto _ : state) {
+        if (mode == 2) {
+            mlp.predict(raw, X.size(), out);
+            bench::do_not_optimize(out);
+            continue;
+        }
+        Tape tape;
+        if (mode == 0) {
+            bench::do_not_optimize(mlp(X[0]));
+        } else {
+            bench::do_not_optimize(mlp(X));
+        }
+        nodes += tape.size();
+    }
+    if (mode != 2) {
+        state.rates["nodes"] = static_cast<double>(nodes);
+    }
+}
+BENCHMARK(BM_mlp_forward)
+    ->args({3, 16, 0})
+    ->args({3, 16, 1})
+    ->args({3, 16, 2})
+    ->args({64, 64, 0})
+    ->args({64, 64, 1})
+    ->args({64, 64, 2});
+
+// Forward, loss, backward and SGD update of MLP 8 -> {width, width, 1} on a
+// minibatch of range(1) samples, per sample (range(2) 0) or fused (1).
+void BM_train_step(bench::State &state) {
+    auto width = static_cast<size_t>(state.range(0));
+    auto batch = static_cast<size_t>(state.range(1));
+    bool fused = state.range(2) != 0;
+    MLP mlp(8, {width, width, 1});
+    SGD sgd(mlp.buffer(), 0.01);
+    std::vector<std::vector<Value>> X = make_batch(batch, 8);
+    std::vector<Value> y = make_input(batch);
+    uint64_t nodes = 0;
+    for (auto _ : state) {
+        Tape tape;
+        std::vector<Value> y_pred;
+        if (fused) {
+            y_pred = flatten(mlp(X));
+        } else {
+            for (const auto &sample : X) {
+                y_pred.push_back(mlp(sample)[0]);
+            }
+        }
+        Value loss = MSE_loss(y, y_pred);
+        sgd.zero_grad();
+        backward(loss);
+        sgd.step();
+        nodes += tape.size();
+    }
+    state.rates["nodes"] = static_cast<double>(nodes);
+}
+BENCHMARK(BM_train_step)
+    ->args({16, 32, 0})
+    ->args({16, 32, 1})
+    ->args({64, 128, 0})
+    ->args({64, 128, 1});
+
+// Forward and backward of one sample through range(0) tanh layers of width
+// range(1), plain (range(2) 0) or checkpointed (1). graph_bytes is the size of
+// the graph held from the end of forward until backward.
+void BM_checkpointing(bench::State &state) {
+    auto depth = static_cast<size_t>(state.range(0));
+    auto width = static_cast<size_t>(state.range(1));
+    MLP mlp(width, std::vector<size_t>(depth, width));
+    mlp.set_checkpointing(state.range(2) != 0);
+    std::vector<Value> input = make_input(width);
+    auto step = [&]() {
+        Tape tape;
+        std::vector<Value> out = mlp(input);
+        Value loss = dot(out, out);
+        mlp.zero_grad();
+        backward(loss);
+    };
+
+    set_profiling(true);
+    reset_profile();
+    {
+        Tape tape;
+        std::vector<Value> out = mlp(input);
+        // Counters are totals over the run, reported per iteration.
+        state.counters["graph_bytes"] = static_cast<double>(profile().bytes) *
+                                        static_cast<double>(state.iterations());
+    }
+    set_profiling(false);
+
+    for (auto _ : state) {
+        step();
+    }
+}
+BENCHMARK(BM_checkpointing)
+    ->args({8, 64, 0})
+    ->args({8, 64, 1})
+    ->args({32, 128, 0})
+    ->args({32, 128, 1});
+
+}  // namespace
@@ -0,0 +1,121 @@
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "bench.hpp"
+#include "value.hpp"
+
+using namespace nn;
+
+namespace {
+
+// Nodes per tape before it is recycled, so tape runs don't grow unbounded.
+constexpr uint64_t TAPE_NODES = 1 << 12;
+
+// Creates one node per iteration with op; on a tape if range(0) is 1.
+template <typename Op>
+void node_creation(bench::State &state, Op op) {
+    Value a = make_value(0.5);
+    Value b = make_value(1.5);
+    bool use_tape = state.range(0) != 0;
+    std::unique_ptr<Tape> tape;
+    uint64_t n = 0;
+    for (auto _ : state) {
+        if (use_tape && n++ % TAPE_NODES == 0) {
+            // Tapes nest, so the old one goes before the next one starts.
+            tape.reset();
+            tape = std::make_unique<Tape>();
+        }
+        Value res = op(a, b);
+        bench::do_not_optimize(res);
+    }
+    state.rates["nodes"] = static_cast<double>(state.iterations());
+}
+
+void BM_add(bench::State &state) {
+    node_creation(state, [](const Value &a, const Value &b) { return a + b; });
+}
+BENCHMARK(BM_add)->args({0})->args({1});
+
+void BM_mul(bench::State &state) {
+    node_creation(state, [](const Value &a, const Value &b) { return a * b; });
+}
+BENCHMARK(BM_mul)->args({0})->args({1});
+
+void BM_pow(bench::State &state) {
+    node_creation(state, [](const Value &a, const Value &) {
+        return pow(a, 3);
+    });
+}
+BENCHMARK(BM_pow)->args({0})->args({1});
+
+void BM_exp(bench::State &state) {
+    node_creation(state, [](const Value &a, const Value &) { return exp(a); });
+}
+BENCHMARK(BM_exp)->args({0})->args({1});
+
+void BM_tanh(bench::State &state) {
+    node_creation(state, [](const Value &a, const Value &) { return tanh(a); });
+}
+BENCHMARK(BM_tanh)->args({0})->args({1});
+
+// Graph of range(0) layers of range(1) nodes; node i of a layer reads nodes i
+// and i + 1 of the layer below.
+std::vector<Value> build_grid(size_t depth, size_t width) {
+    std::vector<Value> layer;
+    for (size_t it = 0; it < width; ++it) {
+        layer.push_back(make_value(0.01 * static_cast<double>(it)));
+    }
+    std::vector<Value> leaves = layer;
+    for (size_t d = 0; d < depth; ++d) {
+        std::vector<Value> next;
+        next.reserve(width);
+        for (size_t it = 0; it < width; ++it) {
+            next.push_back(tanh(layer[it] * layer[(it + 1) % width] + 0.5));
+        }
+        layer = std::move(next);
+    }
+    Value root = layer[0];
+    for (size_t it = 1; it < width; ++it) {
+        root = root + layer[it];
+    }
+    leaves.push_back(root);
+    return leaves;
+}
+
+void BM_backward(bench::State &state) {
+    auto depth = static_cast<size_t>(state.range(0));
+    auto width = static_cast<size_t>(state.range(1));
+    Tape tape;
+    std::vector<Value> graph = build_grid(depth, width);
+    Value root = graph.back();
+    for (auto _ : state) {
+        backward(root, true);
+    }
+    // Three nodes per grid cell plus the final sum.
+    double nodes = static_cast<double>(3 * depth * width + width - 1);
+    state.rates["nodes"] = nodes * static_cast<double>(state.iterations());
+    state.counters["nodes"] = nodes * static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_backward)
+    ->args({10, 1})
+    ->args({100, 1})
+    ->args({1000, 1})
+    ->args({10, 16})
+    ->args({100, 16})
+    ->args({10, 256})
+    ->args({100, 256});
+
+void BM_graph_build(bench::State &state) {
+    auto depth = static_cast<size_t>(state.range(0));
+    auto width = static_cast<size_t>(state.range(1));
+    for (auto _ : state) {
+        Tape tape;
+        std::vector<Value> graph = build_grid(depth, width);
+        bench::do_not_optimize(graph);
+    }
+    double nodes = static_cast<double>(3 * depth * width + width - 1);
+    state.rates["nodes"] = nodes * static_cast<double>(state.iterations());
+}
+BENCHMARK(BM_graph_build)->args({10, 16})->args({100, 256});
+
+}  // namespace
@@ -0,0 +1,36 @@
+#include "alloc_counter.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> n_allocations{0};
+
+}  // namespace
+
+// Kept out of line, so that GCC never pairs the malloc and free inside them
+// with the operator new and delete calls of inlined code.
+[[gnu::noinline]] void *operator new(size_t size) {
+    n_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *res = std::malloc(size == 0 ? 1 : size)) {
+        return res;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+[[gnu::noinline]] void operator delete(void *ptr, size_t /*size*/) noexcept {
+    std::free(ptr);
+}
+
+namespace nn {
+
+uint64_t heap_allocations() {
+    return n_allocations.load(std::memory_order_relaxed);
+}
+
+}  // namespace nn
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+namespace nn {
+
+// Heap allocations made by the process so far. Only available in binaries
+// that link alloc_counter.cpp, which replaces the global operator new and
+// delete with counting versions; the library itself never does.
+uint64_t heap_allocations();
+
+}  // namespace nn
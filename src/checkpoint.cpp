@@ -0,0 +1,253 @@
+#include "checkpoint.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::array<char, 8> MAGIC = {'M', 'I', 'C', 'R', 'O', 'P', 'P', 0};
+constexpr uint32_t ENDIAN_MARK = 0x01020304;
+constexpr uint64_t ALIGNMENT = 64;
+constexpr size_t MAX_HYPERPARAMETERS = 4;
+
+struct Header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t in_size;
+    uint64_t n_layers;
+    uint64_t n_params;
+    uint64_t n_state;
+    uint64_t steps;
+    nn::Optimizer_kind optimizer;
+    uint32_t n_hyperparameters;
+    std::array<double, MAX_HYPERPARAMETERS> hyperparameters;
+    // Byte offsets of the sections from the start of the file.
+    uint64_t layers_offset;
+    uint64_t params_offset;
+    uint64_t state_offset;
+    uint64_t file_size;
+};
+
+static_assert(sizeof(size_t) == sizeof(uint64_t));
+
+uint64_t align(uint64_t offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+}
+
+// Whether count elements of size bytes starting at offset end by end, checked
+// without overflowing on corrupt values.
+bool fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t end) {
+    return offset <= end && count <= (end - offset) / size;
+}
+
+}  // namespace
+
+namespace nn {
+
+struct Checkpoint::Mapping {
+    void *addr = MAP_FAILED;
+    size_t size = 0;
+
+    ~Mapping() {
+        if (addr != MAP_FAILED) {
+            munmap(addr, size);
+        }
+    }
+};
+
+void Checkpoint::save(
+    const std::string &path,
+    const MLP &mlp,
+    const Optimizer *optimizer
+) {
+    std::span<const double> params = mlp.buffer().data();
+    std::span<const double> state;
+    Header header{};
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.byte_order = ENDIAN_MARK;
+    header.in_size = mlp.in_size();
+    header.n_layers = mlp.out_sizes().size();
+    header.n_params = params.size();
+    if (optimizer != nullptr) {
+        state = optimizer->state();
+        header.n_state = state.size();
+        header.steps = optimizer->steps();
+        header.optimizer = optimizer->kind();
+        std::vector<double> hyperparameters = optimizer->hyperparameters();
+        if (hyperparameters.size() > MAX_HYPERPARAMETERS) {
+            throw std::invalid_argument("Checkpoint: too many hyperparameters");
+        }
+        header.n_hyperparameters =
+            static_cast<uint32_t>(hyperparameters.size());
+        std::copy(
+            hyperparameters.begin(), hyperparameters.end(),
+            header.hyperparameters.begin()
+        );
+    }
+    header.layers_offset = align(sizeof(Header));
+    header.params_offset =
+        align(header.layers_offset + header.n_layers * sizeof(uint64_t));
+    header.state_offset =
+        align(header.params_offset + header.n_params * sizeof(double));
+    header.file_size = header.state_offset + header.n_state * sizeof(double);
+
+    // Written next to path and renamed over it, so processes still mapping
+    // the old file keep reading it intact.
+    std::string temp = path + ".tmp";
+    std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+    auto write_at = [&](uint64_t offset, const void *data, size_t size) {
+        // Sections start at most ALIGNMENT - 1 bytes after the previous end.
+        static constexpr std::array<char, ALIGNMENT> zeros{};
+        std::streamoff padding =
+            static_cast<std::streamoff>(offset) - std::streamoff(file.tellp());
+        if (!file || padding < 0 || padding >= std::ssize(zeros)) {
+            file.setstate(std::ios::failbit);
+            return;
+        }
+        file.write(zeros.data(), padding);
+        file.write(
+            static_cast<const char *>(data), static_cast<std::streamsize>(size)
+        );
+    };
+    write_at(0, &header, sizeof(Header));
+    const std::vector<size_t> &layers = mlp.out_sizes();
+    write_at(
+        header.layers_offset, layers.data(), layers.size() * sizeof(uint64_t)
+    );
+    write_at(header.params_offset, params.data(), params.size_bytes());
+    write_at(header.state_offset, state.data(), state.size_bytes());
+    file.close();
+    if (!file || std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("Checkpoint: can't write " + path);
+    }
+}
+
+Checkpoint::Checkpoint(const std::string &path)
+    : mapping_(std::make_shared<Mapping>()) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Checkpoint: can't open " + path);
+    }
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        mapping_->size = static_cast<size_t>(st.st_size);
+        mapping_->addr = mmap(
+            nullptr, mapping_->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0
+        );
+    }
+    close(fd);
+    if (mapping_->addr == MAP_FAILED) {
+        throw std::runtime_error("Checkpoint: can't map " + path);
+    }
+
+    auto *bytes = static_cast<char *>(mapping_->addr);
+    Header header{};
+    if (mapping_->size < sizeof(Header)) {
+        throw std::runtime_error("Checkpoint: truncated header in " + path);
+    }
+    std::memcpy(&header, bytes, sizeof(Header));
+    if (header.magic != MAGIC) {
+        throw std::runtime_error("Checkpoint: not a checkpoint: " + path);
+    }
+    if (header.version != VERSION || header.byte_order != ENDIAN_MARK) {
+        throw std::runtime_error("Checkpoint: unsupported format in " + path);
+    }
+    if (header.file_size != mapping_->size ||
+        header.layers_offset < sizeof(Header) ||
+        !fits(
+            header.layers_offset, header.n_layers, sizeof(uint64_t),
+            header.params_offset
+        ) ||
+        !fits(
+            header.params_offset, header.n_params, sizeof(double),
+            header.state_offset
+        ) ||
+        !fits(
+            header.state_offset, header.n_state, sizeof(double),
+            header.file_size
+        ) ||
+        header.optimizer > Optimizer_kind::RMSPROP ||
+        header.n_hyperparameters > MAX_HYPERPARAMETERS ||
+        header.params_offset % ALIGNMENT != 0 ||
+        header.state_offset % ALIGNMENT != 0) {
+        throw std::runtime_error("Checkpoint: corrupt layout in " + path);
+    }
+
+    in_size_ = header.in_size;
+    out_sizes_.resize(header.n_layers);
+    std::memcpy(
+        out_sizes_.data(), bytes + header.layers_offset,
+        header.n_layers * sizeof(uint64_t)
+    );
+    parameters_ = {
+        reinterpret_cast<double *>(bytes + header.params_offset),
+        header.n_params
+    };
+    state_ = {
+        reinterpret_cast<const double *>(bytes + header.state_offset),
+        header.n_state
+    };
+    steps_ = header.steps;
+    optimizer_kind_ = header.optimizer;
+    hyperparameters_.assign(
+        header.hyperparameters.begin(),
+        header.hyperparameters.begin() + header.n_hyperparameters
+    );
+}
+
+size_t Checkpoint::in_size() const {
+    return in_size_;
+}
+
+const std::vector<size_t> &Checkpoint::out_sizes() const {
+    return out_sizes_;
+}
+
+std::span<const double> Checkpoint::parameters() const {
+    return parameters_;
+}
+
+std::span<const double> Checkpoint::optimizer_state() const {
+    return state_;
+}
+
+uint64_t Checkpoint::optimizer_steps() const {
+    return steps_;
+}
+
+Optimizer_kind Checkpoint::optimizer_kind() const {
+    return optimizer_kind_;
+}
+
+MLP Checkpoint::mlp() const {
+    return MLP(in_size_, out_sizes_, Parameter_buffer(parameters_, mapping_));
+}
+
+MLP Checkpoint::copy() const {
+    return MLP(
+        in_size_, out_sizes_,
+        Parameter_buffer(std::span<const double>(parameters_))
+    );
+}
+
+void Checkpoint::restore(Optimizer &optimizer) const {
+    if (optimizer.kind() != optimizer_kind_ ||
+        optimizer.hyperparameters() != hyperparameters_) {
+        throw std::invalid_argument(
+            "Checkpoint: optimizer differs from the saved one"
+        );
+    }
+    optimizer.restore(state_, steps_);
+}
+
+}  // namespace nn
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "mlp.hpp"
+#include "optim.hpp"
+
+namespace nn {
+
+// Binary MLP checkpoint: a fixed header, the layer sizes, the parameters in
+// the order of MLP::parameters() and the optimizer state, if any, with the
+// kind and hyperparameters of the optimizer in the header. Every
+// section starts at a 64-byte aligned offset, so a mapped file can be used in
+// place. Data is stored in host byte order, which the header records.
+class Checkpoint {
+public:
+    static constexpr uint32_t VERSION = 2;
+
+    // Writes the architecture and parameters of mlp and, if given, the state
+    // of the optimizer training it. The file is written to path + ".tmp" and
+    // renamed over path, so Checkpoints still mapping an older file at path
+    // keep their contents. Throws std::runtime_error on I/O errors.
+    static void save(
+        const std::string &path,
+        const MLP &mlp,
+        const Optimizer *optimizer = nullptr
+    );
+
+    // Memory-maps path copy-on-write and validates its header. Throws
+    // std::runtime_error if the file can't be read or isn't a checkpoint of
+    // this version.
+    explicit Checkpoint(const std::string &path);
+
+    size_t in_size() const;
+    const std::vector<size_t> &out_sizes() const;
+    std::span<const double> parameters() const;
+    std::span<const double> optimizer_state() const;
+    uint64_t optimizer_steps() const;
+    Optimizer_kind optimizer_kind() const;
+
+    // MLP whose parameters view the mapped pages without copying them. Pages
+    // stay shared with every other process mapping the file until written;
+    // the mapping lives as long as any of the parameters.
+    MLP mlp() const;
+    // MLP with its own copy of the parameters.
+    MLP copy() const;
+    // Restores the saved state into an optimizer of the same kind over the
+    // loaded MLP. Throws std::invalid_argument if the kind or hyperparameters
+    // of optimizer differ from the saved ones.
+    void restore(Optimizer &optimizer) const;
+
+private:
+    struct Mapping;
+    std::shared_ptr<Mapping> mapping_;
+    size_t in_size_ = 0;
+    std::vector<size_t> out_sizes_;
+    std::span<double> parameters_;
+    std::span<const double> state_;
+    uint64_t steps_ = 0;
+    Optimizer_kind optimizer_kind_ = Optimizer_kind::NONE;
+    std::vector<double> hyperparameters_;
+};
+
+}  // namespace nn
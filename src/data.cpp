@@ -0,0 +1,390 @@
+#include "data.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+namespace {
+
+using nn::Philox;
+
+constexpr std::array<char, 8> MAGIC = {'M', 'I', 'C', 'R', 'O', 'D', 'A', 'T'};
+constexpr uint32_t VERSION = 1;
+constexpr uint32_t ENDIAN_MARK = 0x01020304;
+constexpr uint64_t DATA_OFFSET = 64;
+
+struct Header {
+    std::array<char, 8> magic;
+    uint32_t version;
+    uint32_t endian_mark;
+    uint64_t n_rows;
+    uint64_t n_features;
+    uint64_t n_targets;
+    uint64_t data_offset;
+};
+
+// Whether header describes a file of exactly size bytes. Checked by division,
+// as the products of corrupt counts can wrap around.
+bool matches_size(const Header &header, uint64_t size) {
+    constexpr uint64_t max_columns =
+        std::numeric_limits<uint64_t>::max() / sizeof(double);
+    if (header.data_offset > size || header.n_features > max_columns ||
+        header.n_targets > max_columns - header.n_features) {
+        return false;
+    }
+    uint64_t row_bytes =
+        (header.n_features + header.n_targets) * sizeof(double);
+    uint64_t data_bytes = size - header.data_offset;
+    if (row_bytes == 0) {
+        return header.n_rows == 0 && data_bytes == 0;
+    }
+    return data_bytes % row_bytes == 0 &&
+           header.n_rows == data_bytes / row_bytes;
+}
+
+// Fisher-Yates shuffle drawing from philox, starting at counter.
+void shuffle(
+    std::vector<size_t> &order,
+    const Philox &philox,
+    uint64_t counter
+) {
+    for (size_t it = order.size(); it > 1; --it) {
+        Philox::Block block = philox(counter++);
+        uint64_t bits = static_cast<uint64_t>(block[0]) << 32 | block[1];
+        std::swap(order[it - 1], order[bits % it]);
+    }
+}
+
+}  // namespace
+
+namespace nn {
+
+void Binary_dataset::write(
+    const std::string &path,
+    size_t n_features,
+    size_t n_targets,
+    std::span<const double> X,
+    std::span<const double> y
+) {
+    size_t n_rows = n_features == 0 ? 0 : X.size() / n_features;
+    if (X.size() != n_rows * n_features || y.size() != n_rows * n_targets) {
+        throw std::invalid_argument("Binary_dataset: row counts differ");
+    }
+    Header header{
+        MAGIC, VERSION, ENDIAN_MARK, n_rows, n_features, n_targets, DATA_OFFSET
+    };
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    std::array<char, DATA_OFFSET> head{};
+    std::memcpy(head.data(), &header, sizeof(Header));
+    file.write(head.data(), head.size());
+    for (size_t row = 0; row < n_rows; ++row) {
+        file.write(
+            reinterpret_cast<const char *>(X.data() + row * n_features),
+            static_cast<std::streamsize>(n_features * sizeof(double))
+        );
+        file.write(
+            reinterpret_cast<const char *>(y.data() + row * n_targets),
+            static_cast<std::streamsize>(n_targets * sizeof(double))
+        );
+    }
+    if (!file) {
+        throw std::runtime_error("Binary_dataset: can't write " + path);
+    }
+}
+
+Binary_dataset::Binary_dataset(
+    const std::string &path,
+    bool shuffle,
+    uint64_t seed
+)
+    : addr_(MAP_FAILED), bytes_(0), shuffle_(shuffle), seed_(seed) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Binary_dataset: can't open " + path);
+    }
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        bytes_ = static_cast<size_t>(st.st_size);
+        addr_ = mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (addr_ == MAP_FAILED) {
+        throw std::runtime_error("Binary_dataset: can't map " + path);
+    }
+
+    Header header{};
+    if (bytes_ >= sizeof(Header)) {
+        std::memcpy(&header, addr_, sizeof(Header));
+    }
+    if (header.magic != MAGIC || header.version != VERSION ||
+        header.endian_mark != ENDIAN_MARK ||
+        header.data_offset != DATA_OFFSET || !matches_size(header, bytes_)) {
+        munmap(addr_, bytes_);
+        throw std::runtime_error("Binary_dataset: not a dataset: " + path);
+    }
+    rows_ = reinterpret_cast<const double *>(
+        static_cast<const char *>(addr_) + header.data_offset
+    );
+    n_rows_ = header.n_rows;
+    n_features_ = header.n_features;
+    n_targets_ = header.n_targets;
+    if (shuffle_) {
+        posix_madvise(addr_, bytes_, POSIX_MADV_RANDOM);
+    }
+    order_.resize(n_rows_);
+    reset(0);
+}
+
+Binary_dataset::~Binary_dataset() {
+    munmap(addr_, bytes_);
+}
+
+size_t Binary_dataset::size() const {
+    return n_rows_;
+}
+
+size_t Binary_dataset::n_features() const {
+    return n_features_;
+}
+
+size_t Binary_dataset::n_targets() const {
+    return n_targets_;
+}
+
+void Binary_dataset::reset(uint64_t epoch) {
+    std::iota(order_.begin(), order_.end(), 0);
+    if (shuffle_) {
+        shuffle(order_, Philox(seed_, epoch), 0);
+    }
+    next_ = 0;
+}
+
+size_t Binary_dataset::read(
+    size_t max_rows,
+    std::span<double> X,
+    std::span<double> y
+) {
+    size_t rows = std::min(max_rows, n_rows_ - next_);
+    size_t stride = n_features_ + n_targets_;
+    for (size_t it = 0; it < rows; ++it) {
+        const double *row = rows_ + order_[next_ + it] * stride;
+        std::copy(row, row + n_features_, X.begin() + it * n_features_);
+        std::copy(row + n_features_, row + stride, y.begin() + it * n_targets_);
+    }
+    next_ += rows;
+    return rows;
+}
+
+Csv_dataset::Csv_dataset(
+    const std::string &path,
+    size_t n_targets,
+    bool shuffle,
+    uint64_t seed,
+    size_t chunk_rows
+)
+    : path_(path),
+      file_(path),
+      n_targets_(n_targets),
+      shuffle_(shuffle),
+      seed_(seed),
+      chunk_rows_(std::max<size_t>(chunk_rows, 1)) {
+    if (!file_) {
+        throw std::runtime_error("Csv_dataset: can't open " + path);
+    }
+    // The first line fixes the number of columns unless it's a header.
+    data_begin_ = file_.tellg();
+    for (int it = 0; it < 2 && std::getline(file_, line_); ++it) {
+        if (parse(line_, row_)) {
+            break;
+        }
+        data_begin_ = file_.tellg();
+        row_.clear();
+    }
+    if (row_.size() <= n_targets_) {
+        throw std::runtime_error("Csv_dataset: no data row in " + path);
+    }
+    n_features_ = row_.size() - n_targets_;
+    reset(0);
+}
+
+size_t Csv_dataset::n_features() const {
+    return n_features_;
+}
+
+size_t Csv_dataset::n_targets() const {
+    return n_targets_;
+}
+
+void Csv_dataset::reset(uint64_t epoch) {
+    file_.clear();
+    file_.seekg(data_begin_);
+    epoch_ = epoch;
+    n_chunks_ = 0;
+    chunk_.clear();
+    order_.clear();
+    next_ = 0;
+}
+
+size_t Csv_dataset::read(
+    size_t max_rows,
+    std::span<double> X,
+    std::span<double> y
+) {
+    size_t stride = n_features_ + n_targets_;
+    size_t rows = 0;
+    while (rows < max_rows) {
+        if (next_ == order_.size()) {
+            load_chunk();
+            if (order_.empty()) {
+                break;
+            }
+        }
+        const double *row = chunk_.data() + order_[next_++] * stride;
+        std::copy(row, row + n_features_, X.begin() + rows * n_features_);
+        std::copy(
+            row + n_features_, row + stride, y.begin() + rows * n_targets_
+        );
+        ++rows;
+    }
+    return rows;
+}
+
+// Splits line on commas into values; false unless every field is a number.
+bool Csv_dataset::parse(const std::string &line, std::vector<double> &values)
+    const {
+    values.clear();
+    const char *begin = line.data();
+    const char *end = begin + line.size();
+    while (end != begin && (end[-1] == '\r' || end[-1] == ' ')) {
+        --end;
+    }
+    if (begin == end) {
+        return false;
+    }
+    while (true) {
+        while (begin != end && *begin == ' ') {
+            ++begin;
+        }
+        double value = 0;
+        auto [ptr, ec] = std::from_chars(begin, end, value);
+        if (ec != std::errc()) {
+            return false;
+        }
+        values.push_back(value);
+        while (ptr != end && *ptr == ' ') {
+            ++ptr;
+        }
+        if (ptr == end) {
+            return true;
+        }
+        if (*ptr != ',') {
+            return false;
+        }
+        begin = ptr + 1;
+    }
+}
+
+// Parses the next chunk_rows lines, skipping blank ones.
+void Csv_dataset::load_chunk() {
+    size_t stride = n_features_ + n_targets_;
+    chunk_.clear();
+    size_t rows = 0;
+    while (rows < chunk_rows_ && std::getline(file_, line_)) {
+        if (line_.find_first_not_of(" \r") == std::string::npos) {
+            continue;
+        }
+        if (!parse(line_, row_) || row_.size() != stride) {
+            throw std::runtime_error("Csv_dataset: malformed row in " + path_);
+        }
+        chunk_.insert(chunk_.end(), row_.begin(), row_.end());
+        ++rows;
+    }
+    order_.resize(rows);
+    std::iota(order_.begin(), order_.end(), 0);
+    if (shuffle_) {
+        shuffle(order_, Philox(seed_, epoch_), n_chunks_ << 32);
+    }
+    ++n_chunks_;
+    next_ = 0;
+}
+
+Data_loader::Data_loader(Dataset &dataset, size_t batch_size)
+    : dataset_(dataset), batch_size_(std::max<size_t>(batch_size, 1)) {
+    dataset_.reset(0);
+    worker_ = std::thread([this]() { work(); });
+}
+
+Data_loader::~Data_loader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    emptied_.notify_all();
+    worker_.join();
+}
+
+bool Data_loader::next(Batch &batch) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    filled_.wait(lock, [this]() { return full_; });
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+    std::swap(batch, ready_);
+    full_ = false;
+    lock.unlock();
+    emptied_.notify_all();
+    if (batch.size == 0) {
+        ++epoch_;
+        return false;
+    }
+    return true;
+}
+
+uint64_t Data_loader::epoch() const {
+    return epoch_;
+}
+
+void Data_loader::work() {
+    size_t n_features = dataset_.n_features();
+    size_t n_targets = dataset_.n_targets();
+    uint64_t epoch = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        emptied_.wait(lock, [this]() { return stop_ || !full_; });
+        if (stop_ || error_) {
+            return;
+        }
+        // Fills the buffers the consumer handed back with its last call.
+        Batch batch = std::move(ready_);
+        lock.unlock();
+        try {
+            batch.X.resize(batch_size_ * n_features);
+            batch.y.resize(batch_size_ * n_targets);
+            batch.size = dataset_.read(batch_size_, batch.X, batch.y);
+            batch.X.resize(batch.size * n_features);
+            batch.y.resize(batch.size * n_targets);
+            if (batch.size == 0) {
+                dataset_.reset(++epoch);
+            }
+        } catch (...) {
+            lock.lock();
+            error_ = std::current_exception();
+            full_ = true;
+            filled_.notify_all();
+            return;
+        }
+        lock.lock();
+        ready_ = std::move(batch);
+        full_ = true;
+        filled_.notify_all();
+    }
+}
+
+}  // namespace nn
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+#include "init.hpp"
+
+namespace nn {
+
+// Source of (features, targets) rows, read in passes over the data.
+class Dataset {
+public:
+    virtual ~Dataset() = default;
+    virtual size_t n_features() const = 0;
+    virtual size_t n_targets() const = 0;
+    // Starts pass `epoch` over the data, in an order that depends only on the
+    // dataset's seed and the epoch if it shuffles.
+    virtual void reset(uint64_t epoch) = 0;
+    // Reads up to max_rows next rows of the pass into the row-major X
+    // [rows x n_features] and y [rows x n_targets]. Returns the number of rows
+    // read, 0 at the end of the pass.
+    virtual size_t read(
+        size_t max_rows,
+        std::span<double> X,
+        std::span<double> y
+    ) = 0;
+};
+
+// Memory-mapped binary dataset: a header followed by rows of n_features then
+// n_targets doubles in host byte order. Rows are only paged in when read, and
+// shuffling is a full permutation of the rows per epoch.
+class Binary_dataset : public Dataset {
+public:
+    // Writes X [n_rows x n_features] and y [n_rows x n_targets] to path.
+    static void write(
+        const std::string &path,
+        size_t n_features,
+        size_t n_targets,
+        std::span<const double> X,
+        std::span<const double> y
+    );
+
+    // Throws std::runtime_error if path can't be mapped or isn't a dataset.
+    explicit Binary_dataset(
+        const std::string &path,
+        bool shuffle = true,
+        uint64_t seed = random_seed()
+    );
+    ~Binary_dataset() override;
+    Binary_dataset(const Binary_dataset &) = delete;
+    Binary_dataset &operator=(const Binary_dataset &) = delete;
+
+    size_t size() const;
+    size_t n_features() const override;
+    size_t n_targets() const override;
+    void reset(uint64_t epoch) override;
+    size_t read(size_t max_rows, std::span<double> X, std::span<double> y)
+        override;
+
+private:
+    void *addr_;
+    size_t bytes_;
+    const double *rows_;
+    size_t n_rows_;
+    size_t n_features_;
+    size_t n_targets_;
+    bool shuffle_;
+    uint64_t seed_;
+    std::vector<size_t> order_;
+    size_t next_ = 0;
+};
+
+// CSV dataset parsed in chunks of chunk_rows lines, so memory stays bounded
+// by the chunk whatever the file size. The last n_targets columns are the
+// targets; a first line that isn't numeric is skipped as a header. Shuffling
+// permutes the rows within each chunk.
+class Csv_dataset : public Dataset {
+public:
+    // Throws std::runtime_error if path can't be read or has no data row.
+    explicit Csv_dataset(
+        const std::string &path,
+        size_t n_targets = 1,
+        bool shuffle = true,
+        uint64_t seed = random_seed(),
+        size_t chunk_rows = 1 << 14
+    );
+
+    size_t n_features() const override;
+    size_t n_targets() const override;
+    void reset(uint64_t epoch) override;
+    size_t read(size_t max_rows, std::span<double> X, std::span<double> y)
+        override;
+
+private:
+    std::string path_;
+    std::ifstream file_;
+    std::streampos data_begin_;
+    size_t n_features_ = 0;
+    size_t n_targets_;
+    bool shuffle_;
+    uint64_t seed_;
+    size_t chunk_rows_;
+    uint64_t epoch_ = 0;
+    uint64_t n_chunks_ = 0;
+    // Parsed rows of the current chunk, in the order they are handed out.
+    std::vector<double> chunk_;
+    std::vector<size_t> order_;
+    std::vector<double> row_;
+    std::string line_;
+    size_t next_ = 0;
+
+    bool parse(const std::string &line, std::vector<double> &values) const;
+    void load_chunk();
+};
+
+// Contiguous minibatch: row-major X [size x n_features], y [size x n_targets].
+struct Batch {
+    size_t size = 0;
+    std::vector<double> X;
+    std::vector<double> y;
+};
+
+// Yields minibatches of a dataset while a background thread reads the next
+// one, so reading and parsing overlap with training. Batch buffers are
+// recycled between calls.
+class Data_loader {
+public:
+    Data_loader(Dataset &dataset, size_t batch_size);
+    ~Data_loader();
+    Data_loader(const Data_loader &) = delete;
+    Data_loader &operator=(const Data_loader &) = delete;
+
+    // Replaces batch with the next minibatch of the current epoch. At the end
+    // of an epoch returns false with an empty batch, and the following call
+    // starts the next epoch. Errors of the reader are rethrown here.
+    bool next(Batch &batch);
+    // Epoch of the batches currently returned.
+    uint64_t epoch() const;
+
+private:
+    Dataset &dataset_;
+    size_t batch_size_;
+    uint64_t epoch_ = 0;
+    std::mutex mutex_;
+    std::condition_variable filled_;
+    std::condition_variable emptied_;
+    Batch ready_;
+    bool full_ = false;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread worker_;
+
+    void work();
+};
+
+}  // namespace nn
@@ -0,0 +1,341 @@
+#include "gemm.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MICROPP_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+using nn::Gemm_isa;
+
+// Blocking in the style of BLIS: a KC x NC panel of B stays in L2/L3 and an
+// MC x KC block of A in L2, both packed so that the micro-kernel streams
+// through them contiguously. MC and NC are multiples of every MR and NR.
+constexpr size_t MC = 128;
+constexpr size_t KC = 256;
+constexpr size_t NC = 2048;
+constexpr size_t MAX_MR = 4;
+constexpr size_t MAX_NR = 16;
+
+// Adds alpha * A_panel * B_panel to the MR x NR tile at c, where A_panel is
+// kc columns of MR packed rows and B_panel is kc rows of NR packed columns.
+using Micro_kernel = void (*)(
+    size_t kc,
+    const double *a,
+    const double *b,
+    double *c,
+    size_t ldc,
+    double alpha
+);
+
+struct Kernel {
+    size_t mr;
+    size_t nr;
+    Micro_kernel fn;
+};
+
+template <size_t MR, size_t NR>
+void kernel_scalar(
+    size_t kc,
+    const double *a,
+    const double *b,
+    double *c,
+    size_t ldc,
+    double alpha
+) {
+    double acc[MR][NR] = {};
+    for (size_t p = 0; p < kc; ++p) {
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+    for (size_t i = 0; i < MR; ++i) {
+        for (size_t j = 0; j < NR; ++j) {
+            c[i * ldc + j] += alpha * acc[i][j];
+        }
+    }
+}
+
+#ifdef MICROPP_X86
+// 4 x 8 tile held in eight ymm accumulators.
+__attribute__((target("avx2,fma"))) void kernel_avx2(
+    size_t kc,
+    const double *a,
+    const double *b,
+    double *c,
+    size_t ldc,
+    double alpha
+) {
+    __m256d c00 = _mm256_setzero_pd();
+    __m256d c01 = _mm256_setzero_pd();
+    __m256d c10 = _mm256_setzero_pd();
+    __m256d c11 = _mm256_setzero_pd();
+    __m256d c20 = _mm256_setzero_pd();
+    __m256d c21 = _mm256_setzero_pd();
+    __m256d c30 = _mm256_setzero_pd();
+    __m256d c31 = _mm256_setzero_pd();
+    for (size_t p = 0; p < kc; ++p) {
+        __m256d b0 = _mm256_loadu_pd(b);
+        __m256d b1 = _mm256_loadu_pd(b + 4);
+        __m256d ai = _mm256_broadcast_sd(a);
+        c00 = _mm256_fmadd_pd(ai, b0, c00);
+        c01 = _mm256_fmadd_pd(ai, b1, c01);
+        ai = _mm256_broadcast_sd(a + 1);
+        c10 = _mm256_fmadd_pd(ai, b0, c10);
+        c11 = _mm256_fmadd_pd(ai, b1, c11);
+        ai = _mm256_broadcast_sd(a + 2);
+        c20 = _mm256_fmadd_pd(ai, b0, c20);
+        c21 = _mm256_fmadd_pd(ai, b1, c21);
+        ai = _mm256_broadcast_sd(a + 3);
+        c30 = _mm256_fmadd_pd(ai, b0, c30);
+        c31 = _mm256_fmadd_pd(ai, b1, c31);
+        a += 4;
+        b += 8;
+    }
+    __m256d va = _mm256_set1_pd(alpha);
+    __m256d rows[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+    for (size_t i = 0; i < 4; ++i) {
+        double *ci = c + i * ldc;
+        _mm256_storeu_pd(
+            ci, _mm256_fmadd_pd(va, rows[i][0], _mm256_loadu_pd(ci))
+        );
+        _mm256_storeu_pd(
+            ci + 4, _mm256_fmadd_pd(va, rows[i][1], _mm256_loadu_pd(ci + 4))
+        );
+    }
+}
+
+// 4 x 16 tile held in eight zmm accumulators.
+__attribute__((target("avx512f"))) void kernel_avx512(
+    size_t kc,
+    const double *a,
+    const double *b,
+    double *c,
+    size_t ldc,
+    double alpha
+) {
+    __m512d acc[4][2];
+    for (auto &row : acc) {
+        row[0] = _mm512_setzero_pd();
+        row[1] = _mm512_setzero_pd();
+    }
+    for (size_t p = 0; p < kc; ++p) {
+        __m512d b0 = _mm512_loadu_pd(b);
+        __m512d b1 = _mm512_loadu_pd(b + 8);
+        for (size_t i = 0; i < 4; ++i) {
+            __m512d ai = _mm512_set1_pd(a[i]);
+            acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+        }
+        a += 4;
+        b += 16;
+    }
+    __m512d va = _mm512_set1_pd(alpha);
+    for (size_t i = 0; i < 4; ++i) {
+        double *ci = c + i * ldc;
+        _mm512_storeu_pd(
+            ci, _mm512_fmadd_pd(va, acc[i][0], _mm512_loadu_pd(ci))
+        );
+        _mm512_storeu_pd(
+            ci + 8, _mm512_fmadd_pd(va, acc[i][1], _mm512_loadu_pd(ci + 8))
+        );
+    }
+}
+#endif
+
+Kernel kernel_for(Gemm_isa isa) {
+    switch (isa) {
+#ifdef MICROPP_X86
+        case Gemm_isa::AVX2:
+            return {4, 8, kernel_avx2};
+        case Gemm_isa::AVX512:
+            return {4, 16, kernel_avx512};
+#endif
+        default:
+            return {4, 8, kernel_scalar<4, 8>};
+    }
+}
+
+Gemm_isa detect_isa() {
+#ifdef MICROPP_X86
+    if (__builtin_cpu_supports("avx512f")) {
+        return Gemm_isa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return Gemm_isa::AVX2;
+    }
+#endif
+    return Gemm_isa::SCALAR;
+}
+
+std::atomic<Gemm_isa> &selected_isa() {
+    static std::atomic<Gemm_isa> isa{detect_isa()};
+    return isa;
+}
+
+// Packs rows [0, mc) and columns [0, kc) of op(A) into panels of mr rows,
+// column by column, zero-padding the last panel.
+void pack_a(
+    bool trans,
+    const double *a,
+    size_t lda,
+    size_t mc,
+    size_t kc,
+    size_t mr,
+    double *dst
+) {
+    for (size_t ir = 0; ir < mc; ir += mr) {
+        size_t rows = std::min(mr, mc - ir);
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t i = 0; i < rows; ++i) {
+                size_t row = ir + i;
+                *dst++ = trans ? a[p * lda + row] : a[row * lda + p];
+            }
+            for (size_t i = rows; i < mr; ++i) {
+                *dst++ = 0;
+            }
+        }
+    }
+}
+
+// Packs rows [0, kc) and columns [0, nc) of op(B) into panels of nr columns,
+// row by row, zero-padding the last panel.
+void pack_b(
+    bool trans,
+    const double *b,
+    size_t ldb,
+    size_t kc,
+    size_t nc,
+    size_t nr,
+    double *dst
+) {
+    for (size_t jr = 0; jr < nc; jr += nr) {
+        size_t cols = std::min(nr, nc - jr);
+        for (size_t p = 0; p < kc; ++p) {
+            for (size_t j = 0; j < cols; ++j) {
+                size_t col = jr + j;
+                *dst++ = trans ? b[col * ldb + p] : b[p * ldb + col];
+            }
+            for (size_t j = cols; j < nr; ++j) {
+                *dst++ = 0;
+            }
+        }
+    }
+}
+
+void scale(size_t m, size_t n, double beta, double *c, size_t ldc) {
+    if (beta == 1) {
+        return;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        double *ci = c + i * ldc;
+        if (beta == 0) {
+            std::fill(ci, ci + n, 0.0);
+        } else {
+            std::for_each(ci, ci + n, [beta](double &val) { val *= beta; });
+        }
+    }
+}
+
+}  // namespace
+
+namespace nn {
+
+void gemm(
+    bool trans_a,
+    bool trans_b,
+    size_t m,
+    size_t n,
+    size_t k,
+    double alpha,
+    const double *a,
+    size_t lda,
+    const double *b,
+    size_t ldb,
+    double beta,
+    double *c,
+    size_t ldc
+) {
+    scale(m, n, beta, c, ldc);
+    if (m == 0 || n == 0 || k == 0 || alpha == 0) {
+        return;
+    }
+
+    Kernel kernel = kernel_for(gemm_isa());
+    thread_local std::vector<double> a_pack(MC * KC);
+    thread_local std::vector<double> b_pack(KC * NC);
+    double edge[MAX_MR * MAX_NR];
+
+    for (size_t jc = 0; jc < n; jc += NC) {
+        size_t nc = std::min(NC, n - jc);
+        for (size_t pc = 0; pc < k; pc += KC) {
+            size_t kc = std::min(KC, k - pc);
+            const double *b_block =
+                trans_b ? b + jc * ldb + pc : b + pc * ldb + jc;
+            pack_b(trans_b, b_block, ldb, kc, nc, kernel.nr, b_pack.data());
+
+            for (size_t ic = 0; ic < m; ic += MC) {
+                size_t mc = std::min(MC, m - ic);
+                const double *a_block =
+                    trans_a ? a + pc * lda + ic : a + ic * lda + pc;
+                pack_a(trans_a, a_block, lda, mc, kc, kernel.mr, a_pack.data());
+
+                for (size_t jr = 0; jr < nc; jr += kernel.nr) {
+                    size_t cols = std::min(kernel.nr, nc - jr);
+                    for (size_t ir = 0; ir < mc; ir += kernel.mr) {
+                        size_t rows = std::min(kernel.mr, mc - ir);
+                        const double *ap = a_pack.data() + ir * kc;
+                        const double *bp = b_pack.data() + jr * kc;
+                        double *cp = c + (ic + ir) * ldc + jc + jr;
+                        if (rows == kernel.mr && cols == kernel.nr) {
+                            kernel.fn(kc, ap, bp, cp, ldc, alpha);
+                            continue;
+                        }
+                        // Partial tile: run the kernel on a scratch tile.
+                        std::fill(edge, edge + kernel.mr * kernel.nr, 0.0);
+                        kernel.fn(kc, ap, bp, edge, kernel.nr, alpha);
+                        for (size_t i = 0; i < rows; ++i) {
+                            for (size_t j = 0; j < cols; ++j) {
+                                cp[i * ldc + j] += edge[i * kernel.nr + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool gemm_isa_supported(Gemm_isa isa) {
+    switch (isa) {
+        case Gemm_isa::SCALAR:
+            return true;
+        case Gemm_isa::AVX2:
+            return detect_isa() != Gemm_isa::SCALAR;
+        case Gemm_isa::AVX512:
+            return detect_isa() == Gemm_isa::AVX512;
+    }
+    return false;
+}
+
+Gemm_isa gemm_isa() {
+    return selected_isa().load(std::memory_order_relaxed);
+}
+
+void set_gemm_isa(Gemm_isa isa) {
+    if (!gemm_isa_supported(isa)) {
+        throw std::invalid_argument("gemm: instruction set not supported");
+    }
+    selected_isa().store(isa, std::memory_order_relaxed);
+}
+
+}  // namespace nn
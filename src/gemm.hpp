@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nn {
+
+// Instruction set of the GEMM micro-kernel.
+enum class Gemm_isa : uint8_t { SCALAR, AVX2, AVX512 };
+
+// C = alpha * op(A) * op(B) + beta * C for row-major matrices, where op(A) is
+// [m x k], op(B) is [k x n] and op(X) is X or X^T. lda, ldb and ldc are the
+// row strides of the matrices as stored.
+void gemm(
+    bool trans_a,
+    bool trans_b,
+    size_t m,
+    size_t n,
+    size_t k,
+    double alpha,
+    const double *a,
+    size_t lda,
+    const double *b,
+    size_t ldb,
+    double beta,
+    double *c,
+    size_t ldc
+);
+
+// The widest kernel the CPU supports is selected on first use; tests and
+// benchmarks may force another supported one.
+bool gemm_isa_supported(Gemm_isa isa);
+Gemm_isa gemm_isa();
+void set_gemm_isa(Gemm_isa isa);
+
+}  // namespace nn
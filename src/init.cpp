@@ -0,0 +1,142 @@
+#include "init.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <numbers>
+#include <random>
+#include "parallel.hpp"
+
+namespace {
+
+using nn::Philox;
+
+constexpr uint32_t PHILOX_M0 = 0xD2511F53;
+constexpr uint32_t PHILOX_M1 = 0xCD9E8D57;
+constexpr uint32_t PHILOX_W0 = 0x9E3779B9;
+constexpr uint32_t PHILOX_W1 = 0xBB67AE85;
+
+std::atomic<uint64_t> thread_streams{0};
+
+// Uniform [0, 1) with 53 random bits from two words of a block.
+double to_unit(uint32_t hi, uint32_t lo) {
+    uint64_t bits = (static_cast<uint64_t>(hi) << 32 | lo) >> 11;
+    return static_cast<double>(bits) * 0x1.0p-53;
+}
+
+// N(0, 1) by Box-Muller from one block.
+double to_normal(const Philox::Block &block) {
+    double u1 = to_unit(block[0], block[1]);
+    double u2 = to_unit(block[2], block[3]);
+    return std::sqrt(-2 * std::log1p(-u1)) *
+           std::cos(2 * std::numbers::pi * u2);
+}
+
+}  // namespace
+
+namespace nn {
+
+Philox::Philox(uint64_t seed, uint64_t stream) : seed_(seed), stream_(stream) {
+}
+
+Philox::Block Philox::operator()(uint64_t counter) const {
+    return round10(
+        {static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32),
+         static_cast<uint32_t>(stream_), static_cast<uint32_t>(stream_ >> 32)},
+        {static_cast<uint32_t>(seed_), static_cast<uint32_t>(seed_ >> 32)}
+    );
+}
+
+Philox::Block Philox::round10(Block counter, std::array<uint32_t, 2> key) {
+    for (int round = 0; round < 10; ++round) {
+        uint64_t prod0 = static_cast<uint64_t>(PHILOX_M0) * counter[0];
+        uint64_t prod1 = static_cast<uint64_t>(PHILOX_M1) * counter[2];
+        counter = {
+            static_cast<uint32_t>(prod1 >> 32) ^ counter[1] ^ key[0],
+            static_cast<uint32_t>(prod1),
+            static_cast<uint32_t>(prod0 >> 32) ^ counter[3] ^ key[1],
+            static_cast<uint32_t>(prod0)
+        };
+        key[0] += PHILOX_W0;
+        key[1] += PHILOX_W1;
+    }
+    return counter;
+}
+
+double random_uniform() {
+    thread_local Philox philox(
+        random_seed(), thread_streams.fetch_add(1, std::memory_order_relaxed)
+    );
+    thread_local uint64_t counter = 0;
+    Philox::Block block = philox(counter++);
+    return to_unit(block[0], block[1]);
+}
+
+uint64_t random_seed() {
+    std::random_device rd;
+    return static_cast<uint64_t>(rd()) << 32 | rd();
+}
+
+Initializer::Initializer(Init scheme, uint64_t seed)
+    : scheme_(scheme), seed_(seed) {
+}
+
+Init Initializer::scheme() const {
+    return scheme_;
+}
+
+uint64_t Initializer::seed() const {
+    return seed_;
+}
+
+double Initializer::operator()(
+    size_t fan_in,
+    size_t fan_out,
+    uint64_t stream,
+    uint64_t index
+) const {
+    Philox::Block block = Philox(seed_, stream)(index);
+    auto in = static_cast<double>(std::max<size_t>(fan_in, 1));
+    auto in_out = static_cast<double>(std::max<size_t>(fan_in + fan_out, 1));
+    double uniform = 2 * to_unit(block[0], block[1]) - 1;
+    switch (scheme_) {
+        case Init::UNIFORM:
+            return uniform;
+        case Init::NORMAL:
+            return to_normal(block);
+        case Init::XAVIER_UNIFORM:
+            return std::sqrt(6 / in_out) * uniform;
+        case Init::XAVIER_NORMAL:
+            return std::sqrt(2 / in_out) * to_normal(block);
+        case Init::HE_UNIFORM:
+            return std::sqrt(6 / in) * uniform;
+        case Init::HE_NORMAL:
+            return std::sqrt(2 / in) * to_normal(block);
+    }
+    return 0;
+}
+
+void Initializer::fill(
+    std::span<double> out,
+    size_t fan_in,
+    size_t fan_out,
+    uint64_t stream,
+    Thread_pool *pool
+) const {
+    auto fill_range = [&](size_t begin, size_t end) {
+        for (size_t it = begin; it < end; ++it) {
+            out[it] = (*this)(fan_in, fan_out, stream, it);
+        }
+    };
+    if (pool == nullptr || pool->size() == 1) {
+        fill_range(0, out.size());
+        return;
+    }
+    size_t n_chunks = pool->size();
+    pool->run(n_chunks, [&](size_t chunk) {
+        fill_range(
+            out.size() * chunk / n_chunks, out.size() * (chunk + 1) / n_chunks
+        );
+    });
+}
+
+}  // namespace nn
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+namespace nn {
+
+class Thread_pool;
+
+// Philox4x32-10 counter-based generator: the block for a counter is a pure
+// function of (key, counter), so any element of a random stream can be
+// computed independently, on any thread.
+class Philox {
+public:
+    using Block = std::array<uint32_t, 4>;
+
+    Philox(uint64_t seed, uint64_t stream);
+    Block operator()(uint64_t counter) const;
+
+    static Block round10(Block counter, std::array<uint32_t, 2> key);
+
+private:
+    uint64_t seed_;
+    uint64_t stream_;
+};
+
+// Uniform [0, 1) from the next value of the calling thread's random stream.
+double random_uniform();
+// Seed drawn from std::random_device.
+uint64_t random_seed();
+
+// Parameter initialization schemes. UNIFORM is U(-1, 1) and NORMAL is
+// N(0, 1); the Xavier schemes scale by fan_in + fan_out, which keeps tanh
+// layers out of saturation, and the He schemes by fan_in, for relu layers.
+enum class Init : uint8_t {
+    UNIFORM,
+    NORMAL,
+    XAVIER_UNIFORM,
+    XAVIER_NORMAL,
+    HE_UNIFORM,
+    HE_NORMAL
+};
+
+// Seedable initializer. Value `index` of stream `stream` depends only on the
+// seed, so an initialization is reproducible regardless of how many threads
+// compute it.
+class Initializer {
+public:
+    explicit Initializer(
+        Init scheme = Init::XAVIER_UNIFORM,
+        uint64_t seed = random_seed()
+    );
+
+    Init scheme() const;
+    uint64_t seed() const;
+    double operator()(
+        size_t fan_in,
+        size_t fan_out,
+        uint64_t stream,
+        uint64_t index
+    ) const;
+    // out[i] = (*this)(fan_in, fan_out, stream, i), split across pool if any.
+    void fill(
+        std::span<double> out,
+        size_t fan_in,
+        size_t fan_out,
+        uint64_t stream,
+        Thread_pool *pool = nullptr
+    ) const;
+
+private:
+    Init scheme_;
+    uint64_t seed_;
+};
+
+}  // namespace nn
@@ -1,29 +1,123 @@
 #include <iostream>
+#include <memory>
+#include <string>
 #include <vector>
+#include "data.hpp"
 #include "mlp.hpp"
+#include "optim.hpp"
+#include "parallel.hpp"
+#include "profile.hpp"
 #include "utils.hpp"
 #include "value.hpp"
 
 using namespace nn;
 
-int main() {
+namespace {
+
+// Trains on a CSV (last column is the target) or binary dataset file,
+// streaming minibatches from a background reader.
+int train_on(const std::string &path, size_t n_threads) {
+    std::unique_ptr<Dataset> dataset;
+    if (path.ends_with(".csv")) {
+        dataset = std::make_unique<Csv_dataset>(path);
+    } else {
+        dataset = std::make_unique<Binary_dataset>(path);
+    }
+    size_t n_features = dataset->n_features();
+    size_t n_targets = dataset->n_targets();
+    MLP nnn(n_features, {16, 16, n_targets});
+    Adam adam(nnn.buffer(), 0.01);
+    Thread_pool pool(n_threads);
+    Data_parallel trainer(nnn, pool);
+
+    Data_loader loader(*dataset, 64);
+    Batch batch;
+    for (int epoch = 0; epoch < 5; ++epoch) {
+        double loss = 0;
+        size_t n_batches = 0;
+        while (loader.next(batch)) {
+            // Only the current minibatch ever becomes Values.
+            std::vector<std::vector<Value>> X(batch.size);
+            std::vector<Value> y;
+            for (size_t it = 0; it < batch.size; ++it) {
+                const double *row = batch.X.data() + it * n_features;
+                for (size_t j = 0; j < n_features; ++j) {
+                    X[it].push_back(make_constant(row[j]));
+                }
+                const double *target = batch.y.data() + it * n_targets;
+                for (size_t j = 0; j < n_targets; ++j) {
+                    y.push_back(make_constant(target[j]));
+                }
+            }
+            adam.zero_grad();
+            loss += trainer.step(X, y);
+            adam.step(&pool);
+            ++n_batches;
+        }
+        std::cout << epoch << " " << loss / static_cast<double>(n_batches)
+                  << '\n';
+    }
+    return 0;
+}
+
+// Prints the autograd profile, if enabled, when training ends.
+struct Profile_report {
+    ~Profile_report() {
+        if (profiling()) {
+            std::cerr << profile();
+        }
+    }
+};
+
+}  // namespace
+
+// Usage: micropp [--profile] [threads] [dataset]
+int main(int argc, char **argv) {
+    std::vector<std::string> args;
+    for (int it = 1; it < argc; ++it) {
+        if (std::string(argv[it]) == "--profile") {
+            set_profiling(true);
+        } else {
+            args.emplace_back(argv[it]);
+        }
+    }
+    Profile_report report;
+    size_t n_threads = args.size() > 0 ? std::stoul(args[0]) : 1;
+    if (args.size() > 1) {
+        return train_on(args[1], n_threads);
+    }
     std::vector<std::vector<Value>> X = {
-        {make_value(2.0), make_value(3.0), make_value(-1.0)},
-        {make_value(3.0), make_value(-1.0), make_value(0.5)},
-        {make_value(0.5), make_value(1.0), make_value(1.0)},
-        {make_value(1.0), make_value(1.0), make_value(-1.0)}
+        {make_constant(2.0), make_constant(3.0), make_constant(-1.0)},
+        {make_constant(3.0), make_constant(-1.0), make_constant(0.5)},
+        {make_constant(0.5), make_constant(1.0), make_constant(1.0)},
+        {make_constant(1.0), make_constant(1.0), make_constant(-1.0)}
     };
     std::vector<Value> y = {
-        make_value(1), make_value(-1), make_value(-1), make_value(1)
+        make_constant(1), make_constant(-1), make_constant(-1), make_constant(1)
     };
     double lr = 0.1;
 
     MLP nnn(3, {4, 4, 1});
 
+    if (n_threads > 1) {
+        Thread_pool pool(n_threads);
+        Data_parallel trainer(nnn, pool);
+        for (int k = 0; k < 20; ++k) {
+            nnn.zero_grad();
+            double loss = trainer.step(X, y);
+            std::cout << k << " " << loss << '\n';
+            nnn.update(lr);
+        }
+        return 0;
+    }
+
     for (int k = 0; k < 20; ++k) {
+        Tape tape;
+        Profile_scope build(Phase::BUILD);
         auto y_pred = flatten(nnn(X));
-        nnn.zero_grad();
         Value loss = MSE_loss(y, y_pred);
+        build.stop();
+        nnn.zero_grad();
         backward(loss);
         std::cout << k << " " << loss << '\n';
         nnn.update(lr);
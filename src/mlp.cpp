@@ -1,45 +1,330 @@
 #include "mlp.hpp"
 #include <algorithm>
+#include <array>
+#include <cmath>
 #include <iostream>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
+#include "gemm.hpp"
 #include "value.hpp"
 
+namespace {
+
+using namespace nn;
+
+// Forward of a whole MLP over a minibatch on the Tensor engine. The inputs are
+// the [batch x in] samples followed by MLP::parameters(); every layer's
+// weights become one [in x out] matrix, so each weight is read once per GEMM
+// tile and its gradient is a single X^T * dY reduction over the batch.
+template <typename T>
+class Batch_block : public Basic_block<T> {
+public:
+    Batch_block(size_t batch, size_t in_size, std::vector<size_t> out_sizes)
+        : batch_(batch), in_size_(in_size), out_sizes_(std::move(out_sizes)) {
+    }
+
+    void forward(std::span<const T> in, std::span<T> out) override {
+        size_t offset = batch_ * in_size_;
+        input_ = make_tensor(
+            {batch_, in_size_},
+            std::vector<double>(in.begin(), in.begin() + offset)
+        );
+        weights_.clear();
+        biases_.clear();
+        Tensor res = input_;
+        size_t layer_in = in_size_;
+        for (size_t it = 0; it < out_sizes_.size(); ++it) {
+            size_t layer_out = out_sizes_[it];
+            Tensor weights = make_tensor({layer_in, layer_out});
+            Tensor bias = make_tensor({layer_out});
+            // Neuron j holds its layer_in weights followed by its bias.
+            for (size_t j = 0; j < layer_out; ++j) {
+                const T *neuron = in.data() + offset + j * (layer_in + 1);
+                for (size_t i = 0; i < layer_in; ++i) {
+                    weights->data()[i * layer_out + j] = neuron[i];
+                }
+                bias->data()[j] = neuron[layer_in];
+            }
+            offset += layer_out * (layer_in + 1);
+
+            res = matmul(res, weights) + bias;
+            if (it != out_sizes_.size() - 1) {
+                res = tanh(res);
+            }
+            weights_.push_back(std::move(weights));
+            biases_.push_back(std::move(bias));
+            layer_in = layer_out;
+        }
+        output_ = res;
+        std::copy(res->data().begin(), res->data().end(), out.begin());
+    }
+
+    void backward(
+        std::span<const T> /*in*/,
+        std::span<const T> out_grad,
+        std::span<T> in_grad
+    ) override {
+        // The leaves outlive one backward pass when the graph is retained.
+        input_->zero_grad();
+        for (size_t it = 0; it < out_sizes_.size(); ++it) {
+            weights_[it]->zero_grad();
+            biases_[it]->zero_grad();
+        }
+        nn::backward(
+            output_, std::vector<double>(out_grad.begin(), out_grad.end())
+        );
+        std::span<const double> input_grad = input_->grad();
+        std::copy(input_grad.begin(), input_grad.end(), in_grad.begin());
+
+        size_t offset = batch_ * in_size_;
+        size_t layer_in = in_size_;
+        for (size_t it = 0; it < out_sizes_.size(); ++it) {
+            size_t layer_out = out_sizes_[it];
+            std::span<const double> weights_grad = weights_[it]->grad();
+            std::span<const double> bias_grad = biases_[it]->grad();
+            for (size_t j = 0; j < layer_out; ++j) {
+                T *neuron = in_grad.data() + offset + j * (layer_in + 1);
+                for (size_t i = 0; i < layer_in; ++i) {
+                    neuron[i] += weights_grad[i * layer_out + j];
+                }
+                neuron[layer_in] += bias_grad[j];
+            }
+            offset += layer_out * (layer_in + 1);
+            layer_in = layer_out;
+        }
+    }
+
+    std::shared_ptr<Basic_block<T>> clone() const override {
+        return std::make_shared<Batch_block>(batch_, in_size_, out_sizes_);
+    }
+
+private:
+    size_t batch_;
+    size_t in_size_;
+    std::vector<size_t> out_sizes_;
+    Tensor input_;
+    std::vector<Tensor> weights_;
+    std::vector<Tensor> biases_;
+    Tensor output_;
+};
+
+// out = in * W^T + b for a row-major [batch x in] input, where neuron j's
+// weights and bias are row j of the [out x (in + 1)] matrix params. Double
+// batches go through one GEMM; everything else is a plain loop.
+template <typename T>
+void affine(
+    const T *in,
+    const T *params,
+    size_t batch,
+    size_t in_size,
+    size_t out_size,
+    T *out
+) {
+    size_t stride = in_size + 1;
+    if constexpr (std::is_same_v<T, double>) {
+        if (batch > 1) {
+            gemm(
+                false, true, batch, out_size, in_size, 1, in, in_size, params,
+                stride, 0, out, out_size
+            );
+            for (size_t row = 0; row < batch; ++row) {
+                for (size_t j = 0; j < out_size; ++j) {
+                    out[row * out_size + j] += params[j * stride + in_size];
+                }
+            }
+            return;
+        }
+    }
+    for (size_t row = 0; row < batch; ++row) {
+        const T *x = in + row * in_size;
+        for (size_t j = 0; j < out_size; ++j) {
+            const T *neuron = params + j * stride;
+            T sum = neuron[in_size];
+            for (size_t i = 0; i < in_size; ++i) {
+                sum += neuron[i] * x[i];
+            }
+            out[row * out_size + j] = sum;
+        }
+    }
+}
+
+// One layer of a checkpointed forward. Forward evaluates the layer from plain
+// scalars and keeps no nodes; backward rematerializes the layer's nodes over
+// fresh input leaves on a tape and runs them, which adds the parameter
+// gradients straight to the parameters. The inputs are the layer's inputs
+// followed by its first parameter, which makes the block require gradients.
+template <typename T>
+class Layer_block : public Basic_block<T> {
+public:
+    Layer_block(
+        std::shared_ptr<const std::vector<Basic_layer<T>>> layers,
+        size_t index,
+        size_t in_size,
+        size_t out_size,
+        bool nonlin,
+        std::span<const T> params
+    )
+        : layers_(std::move(layers)),
+          index_(index),
+          in_size_(in_size),
+          out_size_(out_size),
+          nonlin_(nonlin),
+          params_(params) {
+    }
+
+    void forward(std::span<const T> in, std::span<T> out) override {
+        affine(in.data(), params_.data(), 1, in_size_, out_size_, out.data());
+        if (nonlin_) {
+            for (T &x : out) {
+                x = std::tanh(x);
+            }
+        }
+    }
+
+    void backward(
+        std::span<const T> in,
+        std::span<const T> out_grad,
+        std::span<T> in_grad
+    ) override {
+        Tape tape;
+        Basic_parameter_buffer<T> input(in.first(in_size_));
+        std::vector<Basic_value<T>> res = (*layers_)[index_](input.values());
+        // One sweep from sum(res[j] * out_grad[j]) instead of one per output.
+        std::vector<Basic_value<T>> grads;
+        grads.reserve(out_size_);
+        for (size_t j = 0; j < out_size_; ++j) {
+            grads.push_back(make_constant<T>(out_grad[j]));
+        }
+        // Own order: the thread's default one is in use by the outer sweep.
+        Basic_topo_order<T> order;
+        nn::backward(dot(res, grads), order);
+        std::span<const T> grad = input.grad();
+        for (size_t i = 0; i < in_size_; ++i) {
+            in_grad[i] += grad[i];
+        }
+    }
+
+    std::shared_ptr<Basic_block<T>> clone() const override {
+        return std::make_shared<Layer_block>(*this);
+    }
+
+private:
+    std::shared_ptr<const std::vector<Basic_layer<T>>> layers_;
+    size_t index_;
+    size_t in_size_;
+    size_t out_size_;
+    bool nonlin_;
+    std::span<const T> params_;
+};
+
+// Initial values of all parameters of an MLP, layer by layer. The
+// initializers draw doubles, which float networks round.
+template <typename T>
+std::vector<T> init_parameters(
+    size_t in_size,
+    const std::vector<size_t> &out_sizes,
+    const Initializer &init,
+    Thread_pool *pool
+) {
+    std::vector<double> res;
+    size_t layer_in = in_size;
+    for (size_t it = 0; it < out_sizes.size(); ++it) {
+        size_t layer_out = out_sizes[it];
+        size_t offset = res.size();
+        res.resize(offset + layer_out * (layer_in + 1));
+        std::span<double> values(
+            res.begin() + static_cast<long>(offset), res.end()
+        );
+        init.fill(values, layer_in, layer_out, it, pool);
+        for (size_t j = 0; j < layer_out; ++j) {
+            values[j * (layer_in + 1) + layer_in] = 0;
+        }
+        layer_in = layer_out;
+    }
+    if constexpr (std::is_same_v<T, double>) {
+        return res;
+    } else {
+        return std::vector<T>(res.begin(), res.end());
+    }
+}
+
+// Activation buffers of predict(), reused by every call on the thread.
+template <typename T>
+std::vector<T> &scratch(size_t index, size_t size) {
+    thread_local std::array<std::vector<T>, 2> buffers;
+    std::vector<T> &res = buffers[index];
+    if (res.size() < size) {
+        res.resize(size);
+    }
+    return res;
+}
+
+}  // namespace
+
 namespace nn {
 
-Neuron::Neuron(size_t in_size, bool bias, bool nonlin)
+template <typename T>
+Basic_neuron<T>::Basic_neuron(size_t in_size, bool bias, bool nonlin)
     : in_size_(in_size), nonlin_(nonlin) {
     if (bias) {
-        bias_ = make_value();
+        bias_ = make_value<T>();
     }
     weights_.reserve(in_size);
     for (size_t it = 0; it < in_size; ++it) {
-        weights_.push_back(make_value());
+        weights_.push_back(make_value<T>());
     }
 }
 
-Value Neuron::operator()(const std::vector<Value> &input) const {
-    Value res = bias_;
-    for (size_t it = 0; it < in_size_; ++it) {
-        res = res + input[it] * weights_[it];
+template <typename T>
+Basic_neuron<T>::Basic_neuron(
+    size_t in_size,
+    bool bias,
+    bool nonlin,
+    std::span<const Value> params
+)
+    : weights_(params.begin(), params.begin() + static_cast<long>(in_size)),
+      in_size_(in_size),
+      nonlin_(nonlin) {
+    if (bias) {
+        bias_ = params[in_size];
     }
-    return nonlin_ ? tanh(res) : res;
 }
 
-void Neuron::update(double lr) {
+template <typename T>
+auto Basic_neuron<T>::operator()(const std::vector<Value> &input) const
+    -> Value {
+    return nonlin_ ? tanh_dot(input, weights_, bias_)
+                   : dot(input, weights_, bias_);
+}
+
+template <typename T>
+auto Basic_neuron<T>::parameters() const -> std::vector<Value> {
+    std::vector<Value> res = weights_;
+    if (bias_) {
+        res.push_back(bias_);
+    }
+    return res;
+}
+
+template <typename T>
+void Basic_neuron<T>::update(double lr) {
     bias_->update(lr);
     std::for_each(weights_.begin(), weights_.end(), [lr](Value &value) {
         value->update(lr);
     });
 }
 
-void Neuron::zero_grad() {
+template <typename T>
+void Basic_neuron<T>::zero_grad() {
     bias_->zero_grad();
     std::for_each(weights_.begin(), weights_.end(), [](Value &value) {
         value->zero_grad();
     });
 }
 
-std::ostream &operator<<(std::ostream &os, const Neuron &neuron) {
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_neuron<T> &neuron) {
     os << "Neuron(in: " << neuron.in_size_ << ")\n";
     os << "Bias : " << neuron.bias_ << ", ";
     for (size_t i = 0; i < neuron.in_size_; ++i) {
@@ -48,7 +333,13 @@ std::ostream &operator<<(std::ostream &os, const Neuron &neuron) {
     return os;
 }
 
-Layer::Layer(size_t in_size, size_t out_size, bool bias, bool nonlin)
+template <typename T>
+Basic_layer<T>::Basic_layer(
+    size_t in_size,
+    size_t out_size,
+    bool bias,
+    bool nonlin
+)
     : in_size_(in_size), out_size_(out_size) {
     neurons_.reserve(out_size_);
     for (size_t it = 0; it < out_size; ++it) {
@@ -56,28 +347,63 @@ Layer::Layer(size_t in_size, size_t out_size, bool bias, bool nonlin)
     }
 }
 
-std::vector<Value> Layer::operator()(const std::vector<Value> &input) const {
+template <typename T>
+Basic_layer<T>::Basic_layer(
+    size_t in_size,
+    size_t out_size,
+    bool bias,
+    bool nonlin,
+    std::span<const Value> params
+)
+    : in_size_(in_size), out_size_(out_size) {
+    size_t stride = in_size + (bias ? 1 : 0);
+    neurons_.reserve(out_size_);
+    for (size_t it = 0; it < out_size; ++it) {
+        neurons_.emplace_back(
+            in_size, bias, nonlin, params.subspan(it * stride, stride)
+        );
+    }
+}
+
+template <typename T>
+auto Basic_layer<T>::operator()(const std::vector<Value> &input) const
+    -> std::vector<Value> {
     std::vector<Value> res;
     res.reserve(out_size_);
-    for (const Neuron &neuron : neurons_) {
+    for (const Basic_neuron<T> &neuron : neurons_) {
         res.push_back(neuron(input));
     }
     return res;
 }
 
-void Layer::update(double lr) {
-    std::for_each(neurons_.begin(), neurons_.end(), [lr](Neuron &neuron) {
-        neuron.update(lr);
-    });
+template <typename T>
+auto Basic_layer<T>::parameters() const -> std::vector<Value> {
+    std::vector<Value> res;
+    for (const Basic_neuron<T> &neuron : neurons_) {
+        std::vector<Value> params = neuron.parameters();
+        res.insert(res.end(), params.begin(), params.end());
+    }
+    return res;
 }
 
-void Layer::zero_grad() {
-    std::for_each(neurons_.begin(), neurons_.end(), [](Neuron &neuron) {
-        neuron.zero_grad();
-    });
+template <typename T>
+void Basic_layer<T>::update(double lr) {
+    std::for_each(
+        neurons_.begin(), neurons_.end(),
+        [lr](Basic_neuron<T> &neuron) { neuron.update(lr); }
+    );
 }
 
-std::ostream &operator<<(std::ostream &os, const Layer &layer) {
+template <typename T>
+void Basic_layer<T>::zero_grad() {
+    std::for_each(
+        neurons_.begin(), neurons_.end(),
+        [](Basic_neuron<T> &neuron) { neuron.zero_grad(); }
+    );
+}
+
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_layer<T> &layer) {
     os << "Layer(in: " << layer.in_size_ << ", out: " << layer.out_size_
        << ")\n";
     for (size_t i = 0; i < layer.out_size_; ++i) {
@@ -86,51 +412,322 @@ std::ostream &operator<<(std::ostream &os, const Layer &layer) {
     return os;
 }
 
-MLP::MLP(size_t in_size, std::vector<size_t> out_sizes)
-    : in_size_(in_size),
+template <typename T>
+Basic_MLP<T>::Basic_MLP(
+    size_t in_size,
+    std::vector<size_t> out_sizes,
+    const Initializer &init,
+    Thread_pool *pool
+)
+    : Basic_MLP(
+          in_size,
+          out_sizes,
+          Basic_parameter_buffer<T>(
+              init_parameters<T>(in_size, out_sizes, init, pool)
+          )
+      ) {
+}
+
+template <typename T>
+Basic_MLP<T>::Basic_MLP(
+    size_t in_size,
+    std::vector<size_t> out_sizes,
+    Basic_parameter_buffer<T> buffer
+)
+    : buffer_(std::move(buffer)),
+      in_size_(in_size),
       out_sizes_(std::move(out_sizes)),
       n_layers_(out_sizes_.size()) {
-    layers_.emplace_back(in_size, out_sizes_[0]);
-    for (size_t it = 1; it < n_layers_; ++it) {
+    size_t n = 0;
+    for (size_t it = 0; it < n_layers_; ++it) {
+        n += out_sizes_[it] * ((it == 0 ? in_size_ : out_sizes_[it - 1]) + 1);
+    }
+    if (buffer_.size() != n) {
+        throw std::invalid_argument("MLP: parameter count differs from shape");
+    }
+    std::vector<Value> params = buffer_.values();
+    std::span<const Value> rest = params;
+    layers_.reserve(n_layers_);
+    for (size_t it = 0; it < n_layers_; ++it) {
+        size_t layer_in = it == 0 ? in_size : out_sizes_[it - 1];
+        size_t layer_out = out_sizes_[it];
+        size_t n_params = layer_out * (layer_in + 1);
         layers_.emplace_back(
-            out_sizes_[it - 1], out_sizes_[it], true, it != n_layers_ - 1
+            layer_in, layer_out, true, it != n_layers_ - 1,
+            rest.first(n_params)
         );
+        rest = rest.subspan(n_params);
     }
 }
 
-std::vector<Value> MLP::operator()(const std::vector<Value> &input) const {
+template <typename T>
+auto Basic_MLP<T>::operator()(const std::vector<Value> &input) const
+    -> std::vector<Value> {
     std::vector<Value> res = input;
-    for (const Layer &layer : layers_) {
-        res = layer(res);
+    if (!checkpoint_layers_) {
+        for (const Basic_layer<T> &layer : layers_) {
+            res = layer(res);
+        }
+        return res;
+    }
+    size_t offset = 0;
+    size_t layer_in = in_size_;
+    for (size_t it = 0; it < n_layers_; ++it) {
+        size_t layer_out = out_sizes_[it];
+        size_t n_params = layer_out * (layer_in + 1);
+        res.push_back(buffer_[offset]);
+        res = apply_block(
+            std::make_shared<Layer_block<T>>(
+                checkpoint_layers_, it, layer_in, layer_out,
+                it != n_layers_ - 1, buffer_.data().subspan(offset, n_params)
+            ),
+            res, layer_out
+        );
+        offset += n_params;
+        layer_in = layer_out;
     }
     return res;
 }
 
-std::vector<std::vector<Value>> MLP::operator()(
-    const std::vector<std::vector<Value>> &input
-) const {
+template <typename T>
+auto Basic_MLP<T>::operator()(const std::vector<std::vector<Value>> &input)
+    const -> std::vector<std::vector<Value>> {
     std::vector<std::vector<Value>> res;
-    res.reserve(input.size());
+    if (input.empty()) {
+        return res;
+    }
+    std::vector<Value> inputs;
+    inputs.reserve(input.size() * in_size_);
     for (const auto &vec : input) {
-        res.push_back(this->operator()(vec));
+        if (vec.size() != in_size_) {
+            throw std::invalid_argument("MLP: sample size differs from input");
+        }
+        inputs.insert(inputs.end(), vec.begin(), vec.end());
+    }
+    std::vector<Value> params = parameters();
+    inputs.insert(inputs.end(), params.begin(), params.end());
+
+    size_t out_size = out_sizes_.back();
+    std::vector<Value> outputs = apply_block(
+        std::make_shared<Batch_block<T>>(input.size(), in_size_, out_sizes_),
+        inputs, input.size() * out_size
+    );
+    res.reserve(input.size());
+    for (auto it = outputs.begin(); it != outputs.end(); it += out_size) {
+        res.emplace_back(it, it + static_cast<long>(out_size));
     }
     return res;
 }
 
-void MLP::update(double lr) {
-    std::for_each(layers_.begin(), layers_.end(), [lr](Layer &layer) {
+template <typename T>
+void Basic_MLP<T>::predict(std::span<const T> input, std::span<T> output)
+    const {
+    predict(input, 1, output);
+}
+
+template <typename T>
+void Basic_MLP<T>::predict(
+    std::span<const T> input,
+    size_t batch,
+    std::span<T> output
+) const {
+    if (input.size() != batch * in_size_ ||
+        output.size() != batch * out_sizes_.back()) {
+        throw std::invalid_argument("MLP: predict buffers differ from shape");
+    }
+    size_t width = *std::max_element(out_sizes_.begin(), out_sizes_.end());
+    const T *in = input.data();
+    const T *params = buffer_.data().data();
+    size_t layer_in = in_size_;
+    for (size_t it = 0; it < n_layers_; ++it) {
+        size_t layer_out = out_sizes_[it];
+        bool last = it == n_layers_ - 1;
+        T *out =
+            last ? output.data() : scratch<T>(it % 2, batch * width).data();
+        affine(in, params, batch, layer_in, layer_out, out);
+        if (!last) {
+            std::transform(out, out + batch * layer_out, out, [](T x) {
+                return std::tanh(x);
+            });
+        }
+        params += layer_out * (layer_in + 1);
+        in = out;
+        layer_in = layer_out;
+    }
+}
+
+template <typename T>
+Basic_plan<T> Basic_MLP<T>::compile() const {
+    std::vector<Value> input;
+    input.reserve(in_size_);
+    for (size_t it = 0; it < in_size_; ++it) {
+        input.push_back(make_value<T>(0));
+    }
+    return Basic_plan<T>(input, (*this)(input));
+}
+
+template <typename T>
+auto Basic_MLP<T>::parameters() const -> std::vector<Value> {
+    return buffer_.values();
+}
+
+template <typename T>
+Basic_parameter_buffer<T> &Basic_MLP<T>::buffer() {
+    return buffer_;
+}
+
+template <typename T>
+const Basic_parameter_buffer<T> &Basic_MLP<T>::buffer() const {
+    return buffer_;
+}
+
+template <typename T>
+size_t Basic_MLP<T>::in_size() const {
+    return in_size_;
+}
+
+template <typename T>
+const std::vector<size_t> &Basic_MLP<T>::out_sizes() const {
+    return out_sizes_;
+}
+
+template <typename T>
+Basic_MLP<T> Basic_MLP<T>::replica() const {
+    Basic_MLP res(in_size_, out_sizes_, Initializer(Init::UNIFORM, 0));
+    std::span<const T> src = buffer_.data();
+    std::copy(src.begin(), src.end(), res.buffer_.data().begin());
+    res.set_checkpointing(checkpointing());
+    return res;
+}
+
+template <typename T>
+void Basic_MLP<T>::set_checkpointing(bool checkpointing) {
+    // Shared with the blocks, so that graphs may outlive the MLP.
+    checkpoint_layers_ =
+        checkpointing
+            ? std::make_shared<const std::vector<Basic_layer<T>>>(layers_)
+            : nullptr;
+}
+
+template <typename T>
+bool Basic_MLP<T>::checkpointing() const {
+    return checkpoint_layers_ != nullptr;
+}
+
+template <typename T>
+void Basic_MLP<T>::update(double lr, Thread_pool *pool) {
+    buffer_.update(lr, pool);
+}
+
+template <typename T>
+void Basic_MLP<T>::zero_grad() {
+    buffer_.zero_grad();
+}
+
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_MLP<T> &mlp) {
+    os << "MLP(layers:" << mlp.n_layers_ << ")\n";
+    for (size_t i = 0; i < mlp.n_layers_; ++i) {
+        os << "Layer " << i << " : " << mlp.layers_[i] << '\n';
+    }
+    return os;
+}
+
+#define INSTANTIATE(T)                                                        \
+    template class Basic_neuron<T>;                                           \
+    template class Basic_layer<T>;                                            \
+    template class Basic_MLP<T>;                                              \
+    template std::ostream &operator<<(                                        \
+        std::ostream &, const Basic_neuron<T> &                               \
+    );                                                                        \
+    template std::ostream &operator<<(std::ostream &, const Basic_layer<T> &); \
+    template std::ostream &operator<<(std::ostream &, const Basic_MLP<T> &);
+
+INSTANTIATE(float)
+INSTANTIATE(double)
+#undef INSTANTIATE
+
+Tensor_layer::Tensor_layer(
+    size_t in_size,
+    size_t out_size,
+    bool bias,
+    bool nonlin
+)
+    : in_size_(in_size), out_size_(out_size), nonlin_(nonlin) {
+    double bound = 1 / std::sqrt(static_cast<double>(in_size));
+    weights_ = make_random_tensor({in_size, out_size}, -bound, bound);
+    if (bias) {
+        bias_ = make_tensor({out_size}, 0.0);
+    }
+}
+
+Tensor Tensor_layer::operator()(const Tensor &input) const {
+    Tensor res = matmul(input, weights_);
+    if (bias_) {
+        res = res + bias_;
+    }
+    return nonlin_ ? tanh(res) : res;
+}
+
+void Tensor_layer::update(double lr) {
+    weights_->update(lr);
+    if (bias_) {
+        bias_->update(lr);
+    }
+}
+
+void Tensor_layer::zero_grad() {
+    weights_->zero_grad();
+    if (bias_) {
+        bias_->zero_grad();
+    }
+}
+
+std::ostream &operator<<(std::ostream &os, const Tensor_layer &layer) {
+    os << "Tensor_layer(in: " << layer.in_size_ << ", out: " << layer.out_size_
+       << ")\n";
+    os << "Weights : " << layer.weights_ << '\n';
+    if (layer.bias_) {
+        os << "Bias : " << layer.bias_ << '\n';
+    }
+    return os;
+}
+
+Tensor_MLP::Tensor_MLP(size_t in_size, std::vector<size_t> out_sizes)
+    : in_size_(in_size),
+      out_sizes_(std::move(out_sizes)),
+      n_layers_(out_sizes_.size()) {
+    layers_.reserve(n_layers_);
+    for (size_t it = 0; it < n_layers_; ++it) {
+        layers_.emplace_back(
+            it == 0 ? in_size : out_sizes_[it - 1], out_sizes_[it], true,
+            it != n_layers_ - 1
+        );
+    }
+}
+
+Tensor Tensor_MLP::operator()(const Tensor &input) const {
+    Tensor res = input;
+    for (const Tensor_layer &layer : layers_) {
+        res = layer(res);
+    }
+    return res;
+}
+
+void Tensor_MLP::update(double lr) {
+    std::for_each(layers_.begin(), layers_.end(), [lr](Tensor_layer &layer) {
         layer.update(lr);
     });
 }
 
-void MLP::zero_grad() {
-    std::for_each(layers_.begin(), layers_.end(), [](Layer &layer) {
+void Tensor_MLP::zero_grad() {
+    std::for_each(layers_.begin(), layers_.end(), [](Tensor_layer &layer) {
         layer.zero_grad();
     });
 }
 
-std::ostream &operator<<(std::ostream &os, const MLP &mlp) {
-    os << "MLP(layers:" << mlp.n_layers_ << ")\n";
+std::ostream &operator<<(std::ostream &os, const Tensor_MLP &mlp) {
+    os << "Tensor_MLP(layers:" << mlp.n_layers_ << ")\n";
     for (size_t i = 0; i < mlp.n_layers_; ++i) {
         os << "Layer " << i << " : " << mlp.layers_[i] << '\n';
     }
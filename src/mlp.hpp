@@ -1,16 +1,53 @@
 #pragma once
+#include <memory>
+#include <span>
 #include <vector>
+#include "init.hpp"
+#include "tensor.hpp"
 #include "value.hpp"
 
 namespace nn {
 
-class Neuron {
+template <typename T>
+class Basic_neuron;
+template <typename T>
+class Basic_layer;
+template <typename T>
+class Basic_MLP;
+
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_neuron<T> &neuron);
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_layer<T> &layer);
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_MLP<T> &mlp);
+
+// Like the scalar graph, the networks over it are templated on the scalar
+// type and instantiated for float and double; Neuron, Layer and MLP are the
+// double versions.
+template <typename T>
+class Basic_neuron {
 public:
-    Neuron(size_t in_size, bool bias = true, bool nonlin = true);
+    using Value = Basic_value<T>;
+
+    Basic_neuron(size_t in_size, bool bias = true, bool nonlin = true);
+    // Uses the given parameters: in_size weights, then the bias.
+    Basic_neuron(
+        size_t in_size,
+        bool bias,
+        bool nonlin,
+        std::span<const Value> params
+    );
     Value operator()(const std::vector<Value> &input) const;
+    // Weights followed by the bias, if any.
+    std::vector<Value> parameters() const;
     void update(double lr);
     void zero_grad();
-    friend std::ostream &operator<<(std::ostream &os, const Neuron &neuron);
+    template <typename U>
+    friend std::ostream &operator<<(
+        std::ostream &os,
+        const Basic_neuron<U> &neuron
+    );
 
 private:
     std::vector<Value> weights_;
@@ -19,39 +56,156 @@ private:
     bool nonlin_;
 };
 
-class Layer {
+using Neuron = Basic_neuron<double>;
+
+template <typename T>
+class Basic_layer {
 public:
-    Layer(
+    using Value = Basic_value<T>;
+
+    Basic_layer(
         size_t in_size,
         size_t out_size,
         bool bias = true,
         bool nonlin = true
     );
+    // Uses the given parameters, neuron by neuron.
+    Basic_layer(
+        size_t in_size,
+        size_t out_size,
+        bool bias,
+        bool nonlin,
+        std::span<const Value> params
+    );
     std::vector<Value> operator()(const std::vector<Value> &input) const;
+    std::vector<Value> parameters() const;
     void update(double lr);
     void zero_grad();
-    friend std::ostream &operator<<(std::ostream &os, const Layer &layer);
+    template <typename U>
+    friend std::ostream &operator<<(
+        std::ostream &os,
+        const Basic_layer<U> &layer
+    );
 
 private:
-    std::vector<Neuron> neurons_;
+    std::vector<Basic_neuron<T>> neurons_;
     size_t in_size_;
     size_t out_size_;
 };
 
-class MLP {
+using Layer = Basic_layer<double>;
+
+template <typename T>
+class Basic_MLP {
 public:
-    MLP(size_t in_size, std::vector<size_t> out_sizes);
+    using Value = Basic_value<T>;
+
+    // Weights are drawn from init, layer l using stream l, biases start at 0.
+    // With a pool, the weights are generated in parallel; the result only
+    // depends on the initializer's seed. All parameters live in one
+    // Parameter_buffer, in the order of parameters().
+    Basic_MLP(
+        size_t in_size,
+        std::vector<size_t> out_sizes,
+        const Initializer &init = Initializer(),
+        Thread_pool *pool = nullptr
+    );
+    // Uses the parameters of buffer, in the order of parameters(); they may
+    // view external memory such as a mapped checkpoint.
+    Basic_MLP(
+        size_t in_size,
+        std::vector<size_t> out_sizes,
+        Basic_parameter_buffer<T> buffer
+    );
     std::vector<Value> operator()(const std::vector<Value> &input) const;
+    // Evaluates the whole minibatch as one fused block: activations live in
+    // contiguous [batch x width] buffers and each layer is a single GEMM.
+    // The Tensor engine is double-only, so float networks convert at the
+    // block's boundary.
     std::vector<std::vector<Value>> operator()(
         const std::vector<std::vector<Value>> &input
     ) const;
+    // Inference without a graph: evaluates one sample straight from the
+    // parameter buffer into output, with no allocation once the calling
+    // thread has seen the widest layer.
+    void predict(std::span<const T> input, std::span<T> output) const;
+    // Same for a row-major [batch x in] input, one GEMM per layer for double.
+    void predict(
+        std::span<const T> input,
+        size_t batch,
+        std::span<T> output
+    ) const;
+    // Traces the single-sample forward pass into a Plan whose inputs are the
+    // in_size input values and whose outputs are the network's outputs.
+    Basic_plan<T> compile() const;
+    // Parameters of all neurons, layer by layer.
+    std::vector<Value> parameters() const;
+    Basic_parameter_buffer<T> &buffer();
+    const Basic_parameter_buffer<T> &buffer() const;
+    size_t in_size() const;
+    const std::vector<size_t> &out_sizes() const;
+    // Independent MLP with the same architecture and parameter values.
+    Basic_MLP replica() const;
+    // Gradient checkpointing of the single-sample forward: each layer becomes
+    // one block that stores only its inputs, and its nodes are rebuilt during
+    // backward. Costs about one more forward pass per step, for a graph that
+    // no longer holds every neuron's operands. Off by default.
+    void set_checkpointing(bool checkpointing);
+    bool checkpointing() const;
+    // With a pool, the update is split across its threads.
+    void update(double lr, Thread_pool *pool = nullptr);
+    void zero_grad();
+
+    template <typename U>
+    friend std::ostream &operator<<(std::ostream &os, const Basic_MLP<U> &mlp);
+
+private:
+    Basic_parameter_buffer<T> buffer_;
+    std::vector<Basic_layer<T>> layers_;
+    size_t in_size_;
+    std::vector<size_t> out_sizes_;
+    size_t n_layers_;
+    std::shared_ptr<const std::vector<Basic_layer<T>>> checkpoint_layers_;
+};
+
+using MLP = Basic_MLP<double>;
+
+// Dense layer over the Tensor engine: maps a [batch x in] tensor to
+// [batch x out] with one matrix multiply.
+class Tensor_layer {
+public:
+    Tensor_layer(
+        size_t in_size,
+        size_t out_size,
+        bool bias = true,
+        bool nonlin = true
+    );
+    Tensor operator()(const Tensor &input) const;
     void update(double lr);
     void zero_grad();
+    friend std::ostream &operator<<(
+        std::ostream &os,
+        const Tensor_layer &layer
+    );
 
-    friend std::ostream &operator<<(std::ostream &os, const MLP &mlp);
+private:
+    Tensor weights_;  // [in x out]
+    Tensor bias_;     // [out]
+    size_t in_size_;
+    size_t out_size_;
+    bool nonlin_;
+};
+
+class Tensor_MLP {
+public:
+    Tensor_MLP(size_t in_size, std::vector<size_t> out_sizes);
+    Tensor operator()(const Tensor &input) const;
+    void update(double lr);
+    void zero_grad();
+    friend std::ostream &operator<<(std::ostream &os, const Tensor_MLP &mlp);
 
 private:
-    std::vector<Layer> layers_;
+    std::vector<Tensor_layer> layers_;
     size_t in_size_;
     std::vector<size_t> out_sizes_;
     size_t n_layers_;
@@ -0,0 +1,197 @@
+#include "optim.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+#include "parallel.hpp"
+
+namespace nn {
+
+Optimizer::Optimizer(Parameter_buffer params, double lr, size_t n_slots)
+    : params_(std::move(params)), lr_(lr), state_(n_slots * params_.size()) {
+}
+
+void Optimizer::step(Thread_pool *pool) {
+    ++steps_;
+    prepare();
+    size_t n = params_.size();
+    if (pool == nullptr || pool->size() == 1) {
+        kernel(0, n);
+        return;
+    }
+    size_t n_chunks = pool->size();
+    pool->run(n_chunks, [&](size_t chunk) {
+        kernel(n * chunk / n_chunks, n * (chunk + 1) / n_chunks);
+    });
+}
+
+void Optimizer::zero_grad() {
+    params_.zero_grad();
+}
+
+double Optimizer::lr() const {
+    return lr_;
+}
+
+void Optimizer::set_lr(double lr) {
+    lr_ = lr;
+}
+
+uint64_t Optimizer::steps() const {
+    return steps_;
+}
+
+std::span<double> Optimizer::state() {
+    return state_;
+}
+
+std::span<const double> Optimizer::state() const {
+    return state_;
+}
+
+void Optimizer::restore(std::span<const double> state, uint64_t steps) {
+    if (state.size() != state_.size()) {
+        throw std::invalid_argument("Optimizer: state size differs");
+    }
+    std::copy(state.begin(), state.end(), state_.begin());
+    steps_ = steps;
+}
+
+std::span<double> Optimizer::slot(size_t k) {
+    return std::span<double>(state_).subspan(
+        k * params_.size(), params_.size()
+    );
+}
+
+void Optimizer::prepare() {
+}
+
+SGD::SGD(
+    Parameter_buffer params,
+    double lr,
+    double momentum,
+    double weight_decay
+)
+    : Optimizer(std::move(params), lr, momentum != 0 ? 1 : 0),
+      momentum_(momentum),
+      weight_decay_(weight_decay) {
+}
+
+Optimizer_kind SGD::kind() const {
+    return Optimizer_kind::SGD;
+}
+
+std::vector<double> SGD::hyperparameters() const {
+    return {momentum_, weight_decay_};
+}
+
+void SGD::kernel(size_t begin, size_t end) {
+    double *w = params_.data().data();
+    const double *g = params_.grad().data();
+    if (momentum_ == 0) {
+        for (size_t it = begin; it < end; ++it) {
+            w[it] -= lr_ * (g[it] + weight_decay_ * w[it]);
+        }
+        return;
+    }
+    double *v = slot(0).data();
+    for (size_t it = begin; it < end; ++it) {
+        v[it] = momentum_ * v[it] + g[it] + weight_decay_ * w[it];
+        w[it] -= lr_ * v[it];
+    }
+}
+
+Adam::Adam(
+    Parameter_buffer params,
+    double lr,
+    double beta1,
+    double beta2,
+    double eps,
+    double weight_decay
+)
+    : Adam(std::move(params), lr, beta1, beta2, eps, weight_decay, false) {
+}
+
+Adam::Adam(
+    Parameter_buffer params,
+    double lr,
+    double beta1,
+    double beta2,
+    double eps,
+    double weight_decay,
+    bool decoupled
+)
+    : Optimizer(std::move(params), lr, 2),
+      beta1_(beta1),
+      beta2_(beta2),
+      eps_(eps),
+      weight_decay_(weight_decay),
+      decoupled_(decoupled) {
+}
+
+Optimizer_kind Adam::kind() const {
+    return decoupled_ ? Optimizer_kind::ADAMW : Optimizer_kind::ADAM;
+}
+
+std::vector<double> Adam::hyperparameters() const {
+    return {beta1_, beta2_, eps_, weight_decay_};
+}
+
+void Adam::prepare() {
+    auto t = static_cast<double>(steps_);
+    correction1_ = 1 - std::pow(beta1_, t);
+    correction2_ = 1 - std::pow(beta2_, t);
+}
+
+void Adam::kernel(size_t begin, size_t end) {
+    double *w = params_.data().data();
+    const double *g = params_.grad().data();
+    double *m = slot(0).data();
+    double *v = slot(1).data();
+    double step_size = lr_ / correction1_;
+    double inv_sqrt_c2 = 1 / std::sqrt(correction2_);
+    double l2 = decoupled_ ? 0 : weight_decay_;
+    double decay = decoupled_ ? 1 - lr_ * weight_decay_ : 1;
+    for (size_t it = begin; it < end; ++it) {
+        double grad = g[it] + l2 * w[it];
+        m[it] = beta1_ * m[it] + (1 - beta1_) * grad;
+        v[it] = beta2_ * v[it] + (1 - beta2_) * grad * grad;
+        w[it] = decay * w[it] -
+                step_size * m[it] / (std::sqrt(v[it]) * inv_sqrt_c2 + eps_);
+    }
+}
+
+AdamW::AdamW(
+    Parameter_buffer params,
+    double lr,
+    double beta1,
+    double beta2,
+    double eps,
+    double weight_decay
+)
+    : Adam(std::move(params), lr, beta1, beta2, eps, weight_decay, true) {
+}
+
+RMSProp::RMSProp(Parameter_buffer params, double lr, double alpha, double eps)
+    : Optimizer(std::move(params), lr, 1), alpha_(alpha), eps_(eps) {
+}
+
+Optimizer_kind RMSProp::kind() const {
+    return Optimizer_kind::RMSPROP;
+}
+
+std::vector<double> RMSProp::hyperparameters() const {
+    return {alpha_, eps_};
+}
+
+void RMSProp::kernel(size_t begin, size_t end) {
+    double *w = params_.data().data();
+    const double *g = params_.grad().data();
+    double *s = slot(0).data();
+    for (size_t it = begin; it < end; ++it) {
+        s[it] = alpha_ * s[it] + (1 - alpha_) * g[it] * g[it];
+        w[it] -= lr_ * g[it] / (std::sqrt(s[it]) + eps_);
+    }
+}
+
+}  // namespace nn
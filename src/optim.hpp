@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "value.hpp"
+
+namespace nn {
+
+// Update rules, as recorded in checkpoints.
+enum class Optimizer_kind : uint32_t { NONE, SGD, ADAM, ADAMW, RMSPROP };
+
+// Update rule over a Parameter_buffer. Per-parameter state lives in one
+// contiguous array of n_slots * size() values, and each step is a single fused
+// pass over the parameters that reads the gradient and state and writes the
+// data and state.
+class Optimizer {
+public:
+    Optimizer(Parameter_buffer params, double lr, size_t n_slots);
+    virtual ~Optimizer() = default;
+
+    // Applies one update from the current gradients, split across pool if
+    // any.
+    void step(Thread_pool *pool = nullptr);
+    void zero_grad();
+
+    double lr() const;
+    void set_lr(double lr);
+    // Number of steps taken so far.
+    uint64_t steps() const;
+    // State slots one after the other, e.g. all first moments, then all
+    // second moments.
+    std::span<double> state();
+    std::span<const double> state() const;
+    // Resumes from a saved state and step count; the state size must match.
+    void restore(std::span<const double> state, uint64_t steps);
+    virtual Optimizer_kind kind() const = 0;
+    // Hyperparameters other than the learning rate, which schedules change
+    // during training.
+    virtual std::vector<double> hyperparameters() const = 0;
+
+protected:
+    Parameter_buffer params_;
+    double lr_;
+    uint64_t steps_ = 0;
+    std::vector<double> state_;
+
+    // Slot k of the state, one value per parameter.
+    std::span<double> slot(size_t k);
+    // Called once per step before the kernel runs.
+    virtual void prepare();
+    // Updates parameters [begin, end).
+    virtual void kernel(size_t begin, size_t end) = 0;
+};
+
+// Stochastic gradient descent with optional momentum and L2 weight decay:
+// v = momentum * v + g + weight_decay * w, w -= lr * v.
+class SGD : public Optimizer {
+public:
+    explicit SGD(
+        Parameter_buffer params,
+        double lr,
+        double momentum = 0,
+        double weight_decay = 0
+    );
+
+    Optimizer_kind kind() const override;
+    std::vector<double> hyperparameters() const override;
+
+private:
+    double momentum_;
+    double weight_decay_;
+
+    void kernel(size_t begin, size_t end) override;
+};
+
+// Adam with bias-corrected moments. weight_decay adds weight_decay * w to the
+// gradient.
+class Adam : public Optimizer {
+public:
+    explicit Adam(
+        Parameter_buffer params,
+        double lr = 1e-3,
+        double beta1 = 0.9,
+        double beta2 = 0.999,
+        double eps = 1e-8,
+        double weight_decay = 0
+    );
+
+    Optimizer_kind kind() const override;
+    std::vector<double> hyperparameters() const override;
+
+protected:
+    Adam(
+        Parameter_buffer params,
+        double lr,
+        double beta1,
+        double beta2,
+        double eps,
+        double weight_decay,
+        bool decoupled
+    );
+
+private:
+    double beta1_;
+    double beta2_;
+    double eps_;
+    double weight_decay_;
+    bool decoupled_;
+    // Bias corrections of the current step.
+    double correction1_ = 1;
+    double correction2_ = 1;
+
+    void prepare() override;
+    void kernel(size_t begin, size_t end) override;
+};
+
+// Adam with decoupled weight decay: w -= lr * weight_decay * w on every step,
+// independently of the moments.
+class AdamW : public Adam {
+public:
+    explicit AdamW(
+        Parameter_buffer params,
+        double lr = 1e-3,
+        double beta1 = 0.9,
+        double beta2 = 0.999,
+        double eps = 1e-8,
+        double weight_decay = 1e-2
+    );
+};
+
+// RMSProp: s = alpha * s + (1 - alpha) * g^2, w -= lr * g / (sqrt(s) + eps).
+class RMSProp : public Optimizer {
+public:
+    explicit RMSProp(
+        Parameter_buffer params,
+        double lr = 1e-2,
+        double alpha = 0.99,
+        double eps = 1e-8
+    );
+
+    Optimizer_kind kind() const override;
+    std::vector<double> hyperparameters() const override;
+
+private:
+    double alpha_;
+    double eps_;
+
+    void kernel(size_t begin, size_t end) override;
+};
+
+}  // namespace nn
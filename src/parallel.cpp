@@ -0,0 +1,159 @@
+#include "parallel.hpp"
+#include <algorithm>
+#include <numeric>
+#include "profile.hpp"
+#include "utils.hpp"
+
+namespace nn {
+
+Thread_pool::Thread_pool(size_t n_threads)
+    : n_threads_(std::max<size_t>(n_threads, 1)) {
+    if (n_threads_ == 1) {
+        return;
+    }
+    threads_.reserve(n_threads_);
+    for (size_t it = 0; it < n_threads_; ++it) {
+        threads_.emplace_back([this]() { work(); });
+    }
+}
+
+Thread_pool::~Thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &thread : threads_) {
+        thread.join();
+    }
+}
+
+size_t Thread_pool::size() const {
+    return n_threads_;
+}
+
+void Thread_pool::run(size_t n_tasks, const std::function<void(size_t)> &task) {
+    if (threads_.empty()) {
+        for (size_t it = 0; it < n_tasks; ++it) {
+            task(it);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    task_ = &task;
+    n_tasks_ = n_tasks;
+    next_ = 0;
+    error_ = nullptr;
+    ++generation_;
+    wake_.notify_all();
+    done_.wait(lock, [this]() { return next_ == n_tasks_ && running_ == 0; });
+    task_ = nullptr;
+    if (error_) {
+        std::rethrow_exception(error_);
+    }
+}
+
+void Thread_pool::work() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wake_.wait(lock, [this, seen]() {
+            return stop_ || (generation_ != seen && next_ < n_tasks_);
+        });
+        if (stop_) {
+            return;
+        }
+        while (next_ < n_tasks_) {
+            size_t index = next_++;
+            ++running_;
+            lock.unlock();
+            try {
+                (*task_)(index);
+            } catch (...) {
+                lock.lock();
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+                lock.unlock();
+            }
+            lock.lock();
+            --running_;
+        }
+        seen = generation_;
+        if (running_ == 0) {
+            done_.notify_all();
+        }
+    }
+}
+
+Data_parallel::Data_parallel(MLP &model, Thread_pool &pool)
+    : pool_(pool), params_(model.buffer()) {
+    replicas_.reserve(pool_.size());
+    for (size_t it = 0; it < pool_.size(); ++it) {
+        replicas_.push_back(model.replica());
+    }
+    grads_.assign(pool_.size(), std::vector<double>(params_.size(), 0));
+    losses_.assign(pool_.size(), 0);
+}
+
+double Data_parallel::step(
+    const std::vector<std::vector<Value>> &X,
+    const std::vector<Value> &y
+) {
+    size_t n_shards = replicas_.size();
+    size_t n = X.size();
+    pool_.run(n_shards, [&](size_t shard) {
+        Parameter_buffer &params = replicas_[shard].buffer();
+        std::vector<double> &grads = grads_[shard];
+        std::fill(grads.begin(), grads.end(), 0);
+        losses_[shard] = 0;
+
+        auto begin = static_cast<long>(n * shard / n_shards);
+        auto end = static_cast<long>(n * (shard + 1) / n_shards);
+        if (begin == end) {
+            return;
+        }
+        std::span<const double> data = params_.data();
+        std::copy(data.begin(), data.end(), params.data().begin());
+        params.zero_grad();
+
+        Tape tape;
+        std::vector<std::vector<Value>> shard_X(
+            X.begin() + begin, X.begin() + end
+        );
+        std::vector<Value> shard_y(y.begin() + begin, y.begin() + end);
+        // Weighted so that the shard losses sum to the minibatch mean.
+        double weight =
+            static_cast<double>(end - begin) / static_cast<double>(n);
+        Profile_scope build(Phase::BUILD);
+        Value loss =
+            MSE_loss(shard_y, flatten(replicas_[shard](shard_X))) * weight;
+        build.stop();
+        backward(loss);
+
+        losses_[shard] = loss->get_data();
+        std::span<const double> grad = params.grad();
+        std::copy(grad.begin(), grad.end(), grads.begin());
+    });
+
+    for (size_t stride = 1; stride < n_shards; stride *= 2) {
+        pool_.run((n_shards + 2 * stride - 1) / (2 * stride), [&](size_t pair) {
+            size_t dst = pair * 2 * stride;
+            if (dst + stride >= n_shards) {
+                return;
+            }
+            std::vector<double> &lhs = grads_[dst];
+            const std::vector<double> &rhs = grads_[dst + stride];
+            for (size_t it = 0; it < lhs.size(); ++it) {
+                lhs[it] += rhs[it];
+            }
+        });
+    }
+    std::span<double> grad = params_.grad();
+    for (size_t it = 0; it < grad.size(); ++it) {
+        grad[it] += grads_[0][it];
+    }
+    return std::accumulate(losses_.begin(), losses_.end(), 0.0);
+}
+
+}  // namespace nn
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mlp.hpp"
+#include "value.hpp"
+
+namespace nn {
+
+// Fixed set of worker threads running indexed tasks. A pool of at most one
+// thread runs tasks inline on the caller.
+class Thread_pool {
+public:
+    explicit Thread_pool(size_t n_threads);
+    ~Thread_pool();
+    Thread_pool(const Thread_pool &) = delete;
+    Thread_pool &operator=(const Thread_pool &) = delete;
+
+    size_t size() const;
+    // Runs task(0), ..., task(n_tasks - 1) and waits for all of them. The
+    // first exception thrown by a task is rethrown here.
+    void run(size_t n_tasks, const std::function<void(size_t)> &task);
+
+private:
+    size_t n_threads_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(size_t)> *task_ = nullptr;
+    size_t n_tasks_ = 0;
+    size_t next_ = 0;
+    size_t running_ = 0;
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    void work();
+};
+
+// Data-parallel training step. The minibatch is split into one contiguous
+// shard per pool thread and every shard is trained on its own replica of the
+// model, so backward only writes gradients into thread-private nodes. The
+// per-shard gradients are copied into per-thread buffers and summed by a
+// pairwise tree reduction in a fixed order, so the result depends only on the
+// thread count and not on scheduling.
+class Data_parallel {
+public:
+    Data_parallel(MLP &model, Thread_pool &pool);
+    // Adds the gradient of MSE_loss over the minibatch to the gradients of
+    // the model's parameters and returns the loss.
+    double step(
+        const std::vector<std::vector<Value>> &X,
+        const std::vector<Value> &y
+    );
+
+private:
+    Thread_pool &pool_;
+    Parameter_buffer params_;
+    std::vector<MLP> replicas_;
+    std::vector<std::vector<double>> grads_;
+    std::vector<double> losses_;
+};
+
+}  // namespace nn
@@ -0,0 +1,182 @@
+#include "profile.hpp"
+#include <atomic>
+#include <iomanip>
+#include <ostream>
+
+namespace {
+
+using nn::N_OPS;
+using nn::N_PHASES;
+
+std::atomic<bool> enabled{false};
+std::array<std::atomic<uint64_t>, N_OPS> nodes{};
+std::atomic<uint64_t> bytes{0};
+std::atomic<uint64_t> live_nodes{0};
+std::atomic<uint64_t> peak_live_nodes{0};
+std::array<std::atomic<uint64_t>, N_PHASES> calls{};
+std::array<std::atomic<int64_t>, N_PHASES> time_ns{};
+
+constexpr std::array<const char *, N_PHASES> PHASE_NAMES = {
+    "build", "sort", "backward"
+};
+
+}  // namespace
+
+namespace nn {
+
+const char *op_name(Op op) {
+    switch (op) {
+        case Op::LEAF:
+            return "leaf";
+        case Op::ADD:
+            return "add";
+        case Op::SUB:
+            return "sub";
+        case Op::MUL:
+            return "mul";
+        case Op::DIV:
+            return "div";
+        case Op::SHIFT:
+            return "shift";
+        case Op::SCALE:
+            return "scale";
+        case Op::NEGATE:
+            return "negate";
+        case Op::POW:
+            return "pow";
+        case Op::RELU:
+            return "relu";
+        case Op::EXP:
+            return "exp";
+        case Op::DOT:
+            return "dot";
+        case Op::TANH_DOT:
+            return "tanh_dot";
+        case Op::BLOCK:
+            return "block";
+        case Op::BLOCK_OUTPUT:
+            return "block_output";
+        case Op::LOG:
+            return "log";
+        case Op::TANH:
+            return "tanh";
+        case Op::SIGMOID:
+            return "sigmoid";
+        case Op::GELU:
+            return "gelu";
+        case Op::SOFTPLUS:
+            return "softplus";
+    }
+    return "?";
+}
+
+uint64_t Profile::total_nodes() const {
+    uint64_t total = 0;
+    for (uint64_t count : nodes) {
+        total += count;
+    }
+    return total;
+}
+
+void set_profiling(bool on) {
+    enabled.store(on, std::memory_order_relaxed);
+}
+
+bool profiling() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+Profile profile() {
+    Profile res;
+    for (size_t it = 0; it < N_OPS; ++it) {
+        res.nodes[it] = nodes[it].load(std::memory_order_relaxed);
+    }
+    res.bytes = bytes.load(std::memory_order_relaxed);
+    res.live_nodes = live_nodes.load(std::memory_order_relaxed);
+    res.peak_live_nodes = peak_live_nodes.load(std::memory_order_relaxed);
+    for (size_t it = 0; it < N_PHASES; ++it) {
+        res.calls[it] = calls[it].load(std::memory_order_relaxed);
+        res.time[it] = std::chrono::nanoseconds(
+            time_ns[it].load(std::memory_order_relaxed)
+        );
+    }
+    return res;
+}
+
+void reset_profile() {
+    for (auto &count : nodes) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    bytes.store(0, std::memory_order_relaxed);
+    peak_live_nodes.store(
+        live_nodes.load(std::memory_order_relaxed), std::memory_order_relaxed
+    );
+    for (size_t it = 0; it < N_PHASES; ++it) {
+        calls[it].store(0, std::memory_order_relaxed);
+        time_ns[it].store(0, std::memory_order_relaxed);
+    }
+}
+
+std::ostream &operator<<(std::ostream &os, const Profile &profile) {
+    auto flags = os.flags();
+    os << "nodes " << profile.total_nodes() << ", " << profile.bytes
+       << " bytes, peak live " << profile.peak_live_nodes << ", live "
+       << profile.live_nodes << '\n';
+    for (size_t it = 0; it < N_OPS; ++it) {
+        if (profile.nodes[it] != 0) {
+            os << "  " << std::left << std::setw(14)
+               << op_name(static_cast<Op>(it)) << std::right << std::setw(12)
+               << profile.nodes[it] << '\n';
+        }
+    }
+    for (size_t it = 0; it < N_PHASES; ++it) {
+        std::chrono::duration<double, std::milli> ms = profile.time[it];
+        os << std::left << std::setw(16) << PHASE_NAMES[it] << std::right
+           << std::fixed << std::setprecision(3) << std::setw(12)
+           << ms.count() << " ms in " << profile.calls[it] << " calls\n";
+    }
+    os.flags(flags);
+    return os;
+}
+
+Profile_scope::Profile_scope(Phase phase)
+    : phase_(phase), active_(profiling()) {
+    if (active_) {
+        start_ = std::chrono::steady_clock::now();
+    }
+}
+
+Profile_scope::~Profile_scope() {
+    stop();
+}
+
+void Profile_scope::stop() {
+    if (!active_) {
+        return;
+    }
+    active_ = false;
+    auto elapsed = std::chrono::steady_clock::now() - start_;
+    auto index = static_cast<size_t>(phase_);
+    calls[index].fetch_add(1, std::memory_order_relaxed);
+    time_ns[index].fetch_add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+        std::memory_order_relaxed
+    );
+}
+
+void profile_node_created(Op op, size_t size) {
+    nodes[static_cast<size_t>(op)].fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    uint64_t live = live_nodes.fetch_add(1, std::memory_order_relaxed) + 1;
+    uint64_t peak = peak_live_nodes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_live_nodes.compare_exchange_weak(
+                              peak, live, std::memory_order_relaxed
+                          )) {
+    }
+}
+
+void profile_node_destroyed() {
+    live_nodes.fetch_sub(1, std::memory_order_relaxed);
+}
+
+}  // namespace nn
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include "value.hpp"
+
+namespace nn {
+
+constexpr size_t N_OPS = static_cast<size_t>(Op::SOFTPLUS) + 1;
+
+const char *op_name(Op op);
+
+// Phases of a training step timed by the profiler. BUILD is whatever the
+// caller wraps in a Profile_scope, typically the forward pass; backward()
+// times SORT and BACKWARD itself.
+enum class Phase : uint8_t { BUILD, SORT, BACKWARD };
+
+constexpr size_t N_PHASES = 3;
+
+// Snapshot of the autograd counters since the last reset_profile().
+struct Profile {
+    // Nodes created per op, leaves included.
+    std::array<uint64_t, N_OPS> nodes{};
+    // Bytes of the nodes and their operand arrays, excluding the shared_ptr
+    // control blocks.
+    uint64_t bytes = 0;
+    uint64_t live_nodes = 0;
+    uint64_t peak_live_nodes = 0;
+    std::array<uint64_t, N_PHASES> calls{};
+    std::array<std::chrono::nanoseconds, N_PHASES> time{};
+
+    uint64_t total_nodes() const;
+};
+
+// Opt-in instrumentation of the autograd engine, off by default. While it is
+// off every hook costs one relaxed atomic load; while it is on, the counters
+// are shared atomics, so heavily multi-threaded graph building slows down.
+// Only nodes created while profiling count as live.
+void set_profiling(bool on);
+bool profiling();
+Profile profile();
+// Zeroes the counters; live nodes stay counted and become the new peak.
+void reset_profile();
+// Table of the node counts per op, memory and phase timings.
+std::ostream &operator<<(std::ostream &os, const Profile &profile);
+
+// Adds the lifetime of the scope to the time of phase, if profiling.
+class Profile_scope {
+public:
+    explicit Profile_scope(Phase phase);
+    ~Profile_scope();
+    // Ends the phase before the end of the scope.
+    void stop();
+    Profile_scope(const Profile_scope &) = delete;
+    Profile_scope &operator=(const Profile_scope &) = delete;
+
+private:
+    Phase phase_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Hooks of Value_handler.
+void profile_node_created(Op op, size_t size);
+void profile_node_destroyed();
+
+}  // namespace nn
@@ -0,0 +1,521 @@
+#include "tensor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include "gemm.hpp"
+#include "init.hpp"
+
+namespace {
+std::atomic<uint64_t> sort_epoch{0};
+
+using nn::Shape;
+
+size_t product(const Shape &shape) {
+    return std::accumulate(
+        shape.begin(), shape.end(), size_t{1}, std::multiplies<>()
+    );
+}
+
+Shape row_major_strides(const Shape &shape) {
+    Shape strides(shape.size());
+    size_t stride = 1;
+    for (size_t it = shape.size(); it-- > 0;) {
+        strides[it] = stride;
+        stride *= shape[it];
+    }
+    return strides;
+}
+
+Shape broadcast_shape(const Shape &lhs, const Shape &rhs) {
+    size_t rank = std::max(lhs.size(), rhs.size());
+    Shape res(rank);
+    for (size_t it = 0; it < rank; ++it) {
+        size_t l = it < rank - lhs.size() ? 1 : lhs[it - (rank - lhs.size())];
+        size_t r = it < rank - rhs.size() ? 1 : rhs[it - (rank - rhs.size())];
+        if (l != r && l != 1 && r != 1) {
+            throw std::invalid_argument("tensor shapes are not broadcastable");
+        }
+        res[it] = l == 1 ? r : l;
+    }
+    return res;
+}
+
+// Strides that read a tensor of `shape` as if it had shape `out`: broadcast
+// dimensions step by 0.
+Shape broadcast_strides(const Shape &shape, const Shape &out) {
+    Shape strides = row_major_strides(shape);
+    Shape res(out.size(), 0);
+    size_t offset = out.size() - shape.size();
+    for (size_t it = 0; it < shape.size(); ++it) {
+        res[offset + it] = shape[it] == 1 ? 0 : strides[it];
+    }
+    return res;
+}
+
+// Calls fn(i, l, r) for every flat index i of `out` with the matching flat
+// indices l and r of the broadcast operands.
+template <typename Fn>
+void for_each_broadcast(
+    const Shape &out,
+    const Shape &lhs,
+    const Shape &rhs,
+    Fn fn
+) {
+    size_t n = product(out);
+    if (lhs == out && rhs == out) {
+        for (size_t it = 0; it < n; ++it) {
+            fn(it, it, it);
+        }
+        return;
+    }
+    Shape l_strides = broadcast_strides(lhs, out);
+    Shape r_strides = broadcast_strides(rhs, out);
+    Shape index(out.size(), 0);
+    size_t l = 0;
+    size_t r = 0;
+    for (size_t it = 0; it < n; ++it) {
+        fn(it, l, r);
+        for (size_t dim = out.size(); dim-- > 0;) {
+            l += l_strides[dim];
+            r += r_strides[dim];
+            if (++index[dim] < out[dim]) {
+                break;
+            }
+            l -= l_strides[dim] * out[dim];
+            r -= r_strides[dim] * out[dim];
+            index[dim] = 0;
+        }
+    }
+}
+
+// Sizes of the dimensions before, at and after axis.
+std::array<size_t, 3> split_at(const Shape &shape, size_t axis) {
+    Shape outer(shape.begin(), shape.begin() + static_cast<long>(axis));
+    Shape inner(shape.begin() + static_cast<long>(axis) + 1, shape.end());
+    return {product(outer), shape[axis], product(inner)};
+}
+}  // namespace
+
+namespace nn {
+
+Tensor make_tensor(Shape shape, std::vector<double> data) {
+    if (product(shape) != data.size()) {
+        throw std::invalid_argument("tensor data does not match its shape");
+    }
+    return std::make_shared<Tensor_handler>(std::move(shape), std::move(data));
+}
+
+Tensor make_tensor(Shape shape, double fill) {
+    std::vector<double> data(product(shape), fill);
+    return std::make_shared<Tensor_handler>(std::move(shape), std::move(data));
+}
+
+Tensor make_random_tensor(Shape shape, double low, double high) {
+    std::vector<double> data(product(shape));
+    std::generate(data.begin(), data.end(), [low, high]() {
+        return low + (high - low) * random_uniform();
+    });
+    return std::make_shared<Tensor_handler>(std::move(shape), std::move(data));
+}
+
+Tensor_handler::Tensor_handler(Shape shape, std::vector<double> data)
+    : shape_(std::move(shape)),
+      strides_(row_major_strides(shape_)),
+      data_(std::move(data)) {
+}
+
+Tensor_handler::Tensor_handler(
+    Tensor_op op,
+    Shape shape,
+    std::vector<double> data,
+    Tensor lhs,
+    Tensor rhs,
+    double param
+)
+    : shape_(std::move(shape)),
+      strides_(row_major_strides(shape_)),
+      data_(std::move(data)),
+      prev_{std::move(lhs), std::move(rhs)},
+      param_(param),
+      op_(op) {
+}
+
+Tensor Tensor_handler::make_node(
+    Tensor_op op,
+    Shape shape,
+    std::vector<double> data,
+    const Tensor &lhs,
+    const Tensor &rhs,
+    double param
+) {
+    return std::make_shared<Tensor_handler>(
+        op, std::move(shape), std::move(data), lhs, rhs, param
+    );
+}
+
+const Shape &Tensor_handler::shape() const {
+    return shape_;
+}
+
+const Shape &Tensor_handler::strides() const {
+    return strides_;
+}
+
+size_t Tensor_handler::size() const {
+    return data_.size();
+}
+
+std::span<double> Tensor_handler::data() {
+    return data_;
+}
+
+std::span<const double> Tensor_handler::data() const {
+    return data_;
+}
+
+std::span<const double> Tensor_handler::grad() const {
+    return grad_;
+}
+
+void Tensor_handler::zero_grad() {
+    std::fill(grad_.begin(), grad_.end(), 0);
+}
+
+void Tensor_handler::update(double lr) {
+    for (size_t it = 0; it < grad_.size(); ++it) {
+        data_[it] -= lr * grad_[it];
+    }
+}
+
+std::vector<double> &Tensor_handler::grad_buffer() {
+    if (grad_.empty()) {
+        grad_.assign(data_.size(), 0);
+    }
+    return grad_;
+}
+
+std::span<const Tensor> Tensor_handler::children() const {
+    switch (op_) {
+        case Tensor_op::ADD:
+        case Tensor_op::SUB:
+        case Tensor_op::MUL:
+        case Tensor_op::MATMUL:
+            return {prev_.data(), 2};
+        case Tensor_op::SCALE:
+        case Tensor_op::POW:
+        case Tensor_op::TANH:
+        case Tensor_op::RELU:
+        case Tensor_op::SUM:
+        case Tensor_op::SUM_AXIS:
+        case Tensor_op::MEAN:
+            return {prev_.data(), 1};
+        case Tensor_op::LEAF:
+            break;
+    }
+    return {};
+}
+
+void Tensor_handler::propagate() {
+    Tensor_handler *lhs = prev_[0].get();
+    Tensor_handler *rhs = prev_[1].get();
+    const std::vector<double> &grad = grad_;
+    switch (op_) {
+        case Tensor_op::ADD:
+        case Tensor_op::SUB: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            std::vector<double> &r_grad = rhs->grad_buffer();
+            double sign = op_ == Tensor_op::ADD ? 1 : -1;
+            for_each_broadcast(
+                shape_, lhs->shape_, rhs->shape_,
+                [&](size_t it, size_t l, size_t r) {
+                    l_grad[l] += grad[it];
+                    r_grad[r] += sign * grad[it];
+                }
+            );
+            break;
+        }
+        case Tensor_op::MUL: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            std::vector<double> &r_grad = rhs->grad_buffer();
+            for_each_broadcast(
+                shape_, lhs->shape_, rhs->shape_,
+                [&](size_t it, size_t l, size_t r) {
+                    l_grad[l] += rhs->data_[r] * grad[it];
+                    r_grad[r] += lhs->data_[l] * grad[it];
+                }
+            );
+            break;
+        }
+        case Tensor_op::MATMUL: {
+            // C[m x n] = A[m x k] * B[k x n]
+            size_t m = lhs->shape_[0];
+            size_t k = lhs->shape_[1];
+            size_t n = rhs->shape_[1];
+            // dA += dC * B^T, dB += A^T * dC
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            gemm(
+                false, true, m, k, n, 1, grad.data(), n, rhs->data_.data(), n,
+                1, l_grad.data(), k
+            );
+            std::vector<double> &r_grad = rhs->grad_buffer();
+            gemm(
+                true, false, k, n, m, 1, lhs->data_.data(), k, grad.data(), n,
+                1, r_grad.data(), n
+            );
+            break;
+        }
+        case Tensor_op::SCALE: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            for (size_t it = 0; it < grad.size(); ++it) {
+                l_grad[it] += param_ * grad[it];
+            }
+            break;
+        }
+        case Tensor_op::POW: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            for (size_t it = 0; it < grad.size(); ++it) {
+                l_grad[it] += param_ * std::pow(lhs->data_[it], param_ - 1) *
+                              grad[it];
+            }
+            break;
+        }
+        case Tensor_op::TANH: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            for (size_t it = 0; it < grad.size(); ++it) {
+                l_grad[it] += (1 - data_[it] * data_[it]) * grad[it];
+            }
+            break;
+        }
+        case Tensor_op::RELU: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            for (size_t it = 0; it < grad.size(); ++it) {
+                l_grad[it] += (data_[it] > 0 ? 1 : 0) * grad[it];
+            }
+            break;
+        }
+        case Tensor_op::SUM:
+        case Tensor_op::MEAN: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            double g = grad[0];
+            if (op_ == Tensor_op::MEAN) {
+                g /= static_cast<double>(l_grad.size());
+            }
+            for (double &val : l_grad) {
+                val += g;
+            }
+            break;
+        }
+        case Tensor_op::SUM_AXIS: {
+            std::vector<double> &l_grad = lhs->grad_buffer();
+            auto [outer, len, inner] =
+                split_at(lhs->shape_, static_cast<size_t>(param_));
+            for (size_t o = 0; o < outer; ++o) {
+                for (size_t l = 0; l < len; ++l) {
+                    for (size_t in = 0; in < inner; ++in) {
+                        l_grad[(o * len + l) * inner + in] +=
+                            grad[o * inner + in];
+                    }
+                }
+            }
+            break;
+        }
+        case Tensor_op::LEAF:
+            break;
+    }
+}
+
+Tensor operator+(const Tensor &lhs, const Tensor &rhs) {
+    Shape shape = broadcast_shape(lhs->shape_, rhs->shape_);
+    std::vector<double> data(product(shape));
+    for_each_broadcast(
+        shape, lhs->shape_, rhs->shape_,
+        [&](size_t it, size_t l, size_t r) {
+            data[it] = lhs->data_[l] + rhs->data_[r];
+        }
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::ADD, std::move(shape), std::move(data), lhs, rhs
+    );
+}
+
+Tensor operator-(const Tensor &lhs, const Tensor &rhs) {
+    Shape shape = broadcast_shape(lhs->shape_, rhs->shape_);
+    std::vector<double> data(product(shape));
+    for_each_broadcast(
+        shape, lhs->shape_, rhs->shape_,
+        [&](size_t it, size_t l, size_t r) {
+            data[it] = lhs->data_[l] - rhs->data_[r];
+        }
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::SUB, std::move(shape), std::move(data), lhs, rhs
+    );
+}
+
+Tensor operator*(const Tensor &lhs, const Tensor &rhs) {
+    Shape shape = broadcast_shape(lhs->shape_, rhs->shape_);
+    std::vector<double> data(product(shape));
+    for_each_broadcast(
+        shape, lhs->shape_, rhs->shape_,
+        [&](size_t it, size_t l, size_t r) {
+            data[it] = lhs->data_[l] * rhs->data_[r];
+        }
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::MUL, std::move(shape), std::move(data), lhs, rhs
+    );
+}
+
+Tensor operator*(const Tensor &lhs, double rhs) {
+    std::vector<double> data(lhs->data_);
+    for (double &val : data) {
+        val *= rhs;
+    }
+    return Tensor_handler::make_node(
+        Tensor_op::SCALE, lhs->shape_, std::move(data), lhs, nullptr, rhs
+    );
+}
+
+Tensor matmul(const Tensor &lhs, const Tensor &rhs) {
+    if (lhs->shape_.size() != 2 || rhs->shape_.size() != 2 ||
+        lhs->shape_[1] != rhs->shape_[0]) {
+        throw std::invalid_argument("matmul: expected [m x k] * [k x n]");
+    }
+    size_t m = lhs->shape_[0];
+    size_t k = lhs->shape_[1];
+    size_t n = rhs->shape_[1];
+    std::vector<double> data(m * n);
+    gemm(
+        false, false, m, n, k, 1, lhs->data_.data(), k, rhs->data_.data(), n, 0,
+        data.data(), n
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::MATMUL, {m, n}, std::move(data), lhs, rhs
+    );
+}
+
+Tensor pow(const Tensor &arg, double k) {
+    std::vector<double> data(arg->data_.size());
+    std::transform(
+        arg->data_.begin(), arg->data_.end(), data.begin(),
+        [k](double x) { return std::pow(x, k); }
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::POW, arg->shape_, std::move(data), arg, nullptr, k
+    );
+}
+
+Tensor tanh(const Tensor &arg) {
+    std::vector<double> data(arg->data_.size());
+    std::transform(
+        arg->data_.begin(), arg->data_.end(), data.begin(),
+        [](double x) { return std::tanh(x); }
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::TANH, arg->shape_, std::move(data), arg
+    );
+}
+
+Tensor relu(const Tensor &arg) {
+    std::vector<double> data(arg->data_.size());
+    std::transform(
+        arg->data_.begin(), arg->data_.end(), data.begin(),
+        [](double x) { return x > 0 ? x : 0; }
+    );
+    return Tensor_handler::make_node(
+        Tensor_op::RELU, arg->shape_, std::move(data), arg
+    );
+}
+
+Tensor sum(const Tensor &arg) {
+    double total = std::accumulate(arg->data_.begin(), arg->data_.end(), 0.0);
+    return Tensor_handler::make_node(Tensor_op::SUM, {}, {total}, arg);
+}
+
+Tensor sum(const Tensor &arg, size_t axis) {
+    if (axis >= arg->shape_.size()) {
+        throw std::invalid_argument("sum: axis out of range");
+    }
+    auto [outer, len, inner] = split_at(arg->shape_, axis);
+    std::vector<double> data(outer * inner, 0);
+    for (size_t o = 0; o < outer; ++o) {
+        for (size_t l = 0; l < len; ++l) {
+            for (size_t in = 0; in < inner; ++in) {
+                data[o * inner + in] += arg->data_[(o * len + l) * inner + in];
+            }
+        }
+    }
+    Shape shape = arg->shape_;
+    shape.erase(shape.begin() + static_cast<long>(axis));
+    return Tensor_handler::make_node(
+        Tensor_op::SUM_AXIS, std::move(shape), std::move(data), arg, nullptr,
+        static_cast<double>(axis)
+    );
+}
+
+Tensor mean(const Tensor &arg) {
+    double total = std::accumulate(arg->data_.begin(), arg->data_.end(), 0.0);
+    return Tensor_handler::make_node(
+        Tensor_op::MEAN, {}, {total / static_cast<double>(arg->size())}, arg
+    );
+}
+
+std::ostream &operator<<(std::ostream &os, const Tensor &tensor) {
+    os << "Tensor([";
+    for (size_t it = 0; it < tensor->shape_.size(); ++it) {
+        os << (it == 0 ? "" : ", ") << tensor->shape_[it];
+    }
+    os << "] |";
+    for (double val : tensor->data_) {
+        os << ' ' << val;
+    }
+    os << ")";
+    return os;
+}
+
+void backward(const Tensor &tensor) {
+    backward(tensor, std::vector<double>(tensor->size(), 1));
+}
+
+void backward(const Tensor &tensor, std::vector<double> grad) {
+    if (grad.size() != tensor->size()) {
+        throw std::invalid_argument("backward: gradient does not match shape");
+    }
+    // Iterative DFS in the same way as the scalar Topo_order, leaves are
+    // never pushed or marked.
+    uint64_t epoch = sort_epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+    std::vector<Tensor_handler *> order;
+    std::vector<std::pair<Tensor_handler *, size_t>> stack;
+    tensor->mark_ = epoch;
+    stack.emplace_back(tensor.get(), 0);
+    while (!stack.empty()) {
+        auto &[node, next] = stack.back();
+        std::span<const Tensor> children = node->children();
+        if (next == children.size()) {
+            order.push_back(node);
+            stack.pop_back();
+            continue;
+        }
+        Tensor_handler *child = children[next++].get();
+        if (child->op_ != Tensor_op::LEAF && child->mark_ != epoch) {
+            child->mark_ = epoch;
+            stack.emplace_back(child, 0);
+        }
+    }
+
+    // Gradients left by an earlier pass over the same graph would otherwise
+    // be propagated again.
+    for (Tensor_handler *node : order) {
+        node->zero_grad();
+    }
+    tensor->grad_ = std::move(grad);
+    std::for_each(order.rbegin(), order.rend(), [](Tensor_handler *node) {
+        node->propagate();
+    });
+}
+
+}  // namespace nn
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace nn {
+
+// Dense counterpart of the scalar Value graph: a node owns a whole contiguous
+// row-major buffer, so a batch of activations is one node instead of one
+// heap-allocated Value per element. Entries are always double; unlike the
+// scalar graph, tensors have no float variant.
+class Tensor_handler;
+using Tensor = std::shared_ptr<Tensor_handler>;
+using Shape = std::vector<size_t>;
+
+Tensor make_tensor(Shape shape, std::vector<double> data);
+Tensor make_tensor(Shape shape, double fill = 0);
+// Tensor with entries drawn uniformly from [low, high).
+Tensor make_random_tensor(Shape shape, double low, double high);
+void backward(const Tensor &tensor);
+// Backpropagates the given gradient of tensor instead of ones.
+void backward(const Tensor &tensor, std::vector<double> grad);
+
+// Operation that produced a tensor; selects its backward rule.
+enum class Tensor_op : uint8_t {
+    LEAF,
+    ADD,
+    SUB,
+    MUL,
+    MATMUL,
+    SCALE,
+    POW,
+    TANH,
+    RELU,
+    SUM,
+    SUM_AXIS,
+    MEAN
+};
+
+class Tensor_handler {
+public:
+    Tensor_handler(Shape shape, std::vector<double> data);
+    Tensor_handler(
+        Tensor_op op,
+        Shape shape,
+        std::vector<double> data,
+        Tensor lhs,
+        Tensor rhs,
+        double param
+    );
+
+    const Shape &shape() const;
+    const Shape &strides() const;
+    size_t size() const;
+    std::span<double> data();
+    std::span<const double> data() const;
+    // Empty until a gradient has been propagated into this tensor.
+    std::span<const double> grad() const;
+    void zero_grad();
+    void update(double lr);
+
+    friend void backward(const Tensor &tensor, std::vector<double> grad);
+
+    // Elementwise ops broadcast their operands numpy-style.
+    friend Tensor operator+(const Tensor &lhs, const Tensor &rhs);
+    friend Tensor operator-(const Tensor &lhs, const Tensor &rhs);
+    friend Tensor operator*(const Tensor &lhs, const Tensor &rhs);
+    friend Tensor operator*(const Tensor &lhs, double rhs);
+    friend Tensor matmul(const Tensor &lhs, const Tensor &rhs);
+    friend Tensor pow(const Tensor &arg, double k);
+    friend Tensor tanh(const Tensor &arg);
+    friend Tensor relu(const Tensor &arg);
+    friend Tensor sum(const Tensor &arg);
+    friend Tensor sum(const Tensor &arg, size_t axis);
+    friend Tensor mean(const Tensor &arg);
+
+    friend std::ostream &operator<<(std::ostream &os, const Tensor &tensor);
+
+private:
+    Shape shape_;
+    Shape strides_;
+    std::vector<double> data_;
+    std::vector<double> grad_;
+    std::array<Tensor, 2> prev_;
+    // Constant operand of the op: the factor of SCALE, the exponent of POW or
+    // the reduced axis of SUM_AXIS.
+    double param_ = 0;
+    // Epoch of the last topological sort that visited this node.
+    uint64_t mark_ = 0;
+    Tensor_op op_ = Tensor_op::LEAF;
+
+    static Tensor make_node(
+        Tensor_op op,
+        Shape shape,
+        std::vector<double> data,
+        const Tensor &lhs,
+        const Tensor &rhs = nullptr,
+        double param = 0
+    );
+    std::span<const Tensor> children() const;
+    std::vector<double> &grad_buffer();
+    void propagate();
+};
+
+}  // namespace nn
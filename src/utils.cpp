@@ -3,8 +3,12 @@
 #include "value.hpp"
 
 namespace nn {
-Value MSE_loss(const std::vector<Value> &y, const std::vector<Value> &y_pred) {
-    Value loss = make_value(0);
+template <typename T>
+Basic_value<T> MSE_loss(
+    const std::vector<Basic_value<T>> &y,
+    const std::vector<Basic_value<T>> &y_pred
+) {
+    Basic_value<T> loss = make_constant<T>(0);
     loss->set_label("mse");
     int n = static_cast<int>(y.size());
     for (int i = 0; i < n; ++i) {
@@ -14,8 +18,15 @@ Value MSE_loss(const std::vector<Value> &y, const std::vector<Value> &y_pred) {
     return loss;
 }
 
-std::vector<Value> flatten(const std::vector<std::vector<Value>> &data) {
-    std::vector<Value> res;
+Tensor MSE_loss(const Tensor &y, const Tensor &y_pred) {
+    return mean(pow(y - y_pred, 2));
+}
+
+template <typename T>
+std::vector<Basic_value<T>> flatten(
+    const std::vector<std::vector<Basic_value<T>>> &data
+) {
+    std::vector<Basic_value<T>> res;
     std::for_each(data.begin(), data.end(), [&res](const auto &vec) {
         std::for_each(vec.begin(), vec.end(), [&res](const auto &val) {
             res.push_back(val);
@@ -23,4 +34,17 @@ std::vector<Value> flatten(const std::vector<std::vector<Value>> &data) {
     });
     return res;
 }
+
+#define INSTANTIATE(T)                                                        \
+    template Basic_value<T> MSE_loss(                                         \
+        const std::vector<Basic_value<T>> &,                                  \
+        const std::vector<Basic_value<T>> &                                   \
+    );                                                                        \
+    template std::vector<Basic_value<T>> flatten(                             \
+        const std::vector<std::vector<Basic_value<T>>> &                      \
+    );
+
+INSTANTIATE(float)
+INSTANTIATE(double)
+#undef INSTANTIATE
 }  // namespace nn
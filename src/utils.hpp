@@ -1,7 +1,16 @@
 #pragma once
+#include "tensor.hpp"
 #include "value.hpp"
 
 namespace nn {
-Value MSE_loss(const std::vector<Value> &y, const std::vector<Value> &y_pred);
-std::vector<Value> flatten(const std::vector<std::vector<Value>> &data);
+template <typename T>
+Basic_value<T> MSE_loss(
+    const std::vector<Basic_value<T>> &y,
+    const std::vector<Basic_value<T>> &y_pred
+);
+Tensor MSE_loss(const Tensor &y, const Tensor &y_pred);
+template <typename T>
+std::vector<Basic_value<T>> flatten(
+    const std::vector<std::vector<Basic_value<T>>> &data
+);
 }  // namespace nn
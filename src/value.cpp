@@ -1,185 +1,1288 @@
 #include "value.hpp"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
-#include <random>
-#include <unordered_set>
+#include <numbers>
+#include <stdexcept>
+#include <unordered_map>
+#include "init.hpp"
+#include "parallel.hpp"
+#include "profile.hpp"
 
 namespace {
-std::random_device rd;
-std::mt19937 gen(rd());
-std::uniform_real_distribution<> dist(0, 1);
+std::atomic<uint64_t> sort_epoch{0};
+constexpr const char *FREED_GRAPH =
+    "backward: graph already freed, use retain_graph to run it again";
+// Worklist of the graph teardown running on this thread, if any.
+template <typename T>
+thread_local std::vector<nn::Basic_value<T>> *teardown = nullptr;
+
+template <typename T>
+T logistic(T x) {
+    return 1 / (1 + std::exp(-x));
+}
+
+// Standard normal cdf and pdf; gelu(x) = x * normal_cdf(x).
+template <typename T>
+T normal_cdf(T x) {
+    return T(0.5) * std::erfc(-x / std::numbers::sqrt2_v<T>);
+}
+
+template <typename T>
+T normal_pdf(T x) {
+    return std::exp(T(-0.5) * x * x) * std::numbers::inv_sqrtpi_v<T> /
+           std::numbers::sqrt2_v<T>;
+}
 }  // namespace
 
 namespace nn {
 
-Value make_value(double data, std::vector<Value> childs) {
-    return std::make_shared<Value_handler>(data, childs);
+
+thread_local Tape *Tape::current_ = nullptr;
+
+Tape::Tape(size_t initial_bytes) : arena_(initial_bytes), outer_(current_) {
+    current_ = this;
+}
+
+Tape::~Tape() {
+    current_ = outer_;
+}
+
+size_t Tape::size() const {
+    return n_nodes_;
+}
+
+Tape *Tape::current() {
+    return current_;
 }
 
-Value make_value() {
-    return std::make_shared<Value_handler>();
+template <typename T>
+struct Basic_parameter_buffer<T>::Storage {
+    std::vector<T> own_data;
+    std::shared_ptr<void> owner;
+    std::span<T> data;
+    std::vector<T> grad;
+    std::unique_ptr<std::optional<Basic_value_handler<T>>[]> nodes;
+};
+
+template <typename T>
+Basic_parameter_buffer<T>::Basic_parameter_buffer(std::span<const T> data)
+    : storage_(std::make_shared<Storage>()) {
+    storage_->own_data.assign(data.begin(), data.end());
+    storage_->data = storage_->own_data;
+    bind();
 }
 
-Value_handler::Value_handler() : data_(dist(gen)), grad_(0) {
+template <typename T>
+Basic_parameter_buffer<T>::Basic_parameter_buffer(
+    std::span<T> data,
+    std::shared_ptr<void> owner
+)
+    : storage_(std::make_shared<Storage>()) {
+    storage_->owner = std::move(owner);
+    storage_->data = data;
+    bind();
 }
 
-Value_handler::Value_handler(double data, std::vector<Value> childs)
-    : data_(data), grad_(0), prev_(std::move(childs)) {};
+// Creates the leaves over the storage's data and gradients.
+template <typename T>
+void Basic_parameter_buffer<T>::bind() {
+    size_t n = storage_->data.size();
+    storage_->grad.assign(n, 0);
+    storage_->nodes =
+        std::make_unique<std::optional<Basic_value_handler<T>>[]>(n);
+    values_.reserve(n);
+    for (size_t it = 0; it < n; ++it) {
+        Basic_value_handler<T> &node = storage_->nodes[it].emplace(
+            storage_->data[it], storage_->grad[it]
+        );
+        // Aliasing handle: shares ownership of the whole storage.
+        values_.emplace_back(storage_, &node);
+    }
+}
 
-double Value_handler::get_data() const {
-    return data_;
+template <typename T>
+size_t Basic_parameter_buffer<T>::size() const {
+    return values_.size();
 }
 
-double Value_handler::get_grad() const {
-    return grad_;
+template <typename T>
+std::span<T> Basic_parameter_buffer<T>::data() const {
+    return storage_->data;
 }
 
-void Value_handler::zero_grad() {
-    grad_ = 0;
+template <typename T>
+std::span<T> Basic_parameter_buffer<T>::grad() const {
+    return storage_->grad;
 }
 
-void Value_handler::update(double lr) {
-    data_ -= lr * grad_;
+template <typename T>
+auto Basic_parameter_buffer<T>::operator[](size_t index) const
+    -> const Value & {
+    return values_[index];
 }
 
-void Value_handler::set_label(std::string label) {
-    label_ = std::move(label);
+template <typename T>
+auto Basic_parameter_buffer<T>::values() const -> std::vector<Value> {
+    return values_;
 }
 
-Value operator+(const Value &lhs, const Value &rhs) {
-    Value res = make_value(lhs->data_ + rhs->data_, {lhs, rhs});
-    Value_handler *weak_res = res.get();
-    res->backward_ = [weak_res]() {
-        weak_res->prev_[0]->grad_ += weak_res->grad_;
-        weak_res->prev_[1]->grad_ += weak_res->grad_;
+template <typename T>
+void Basic_parameter_buffer<T>::zero_grad() {
+    std::fill(storage_->grad.begin(), storage_->grad.end(), 0);
+}
+
+template <typename T>
+void Basic_parameter_buffer<T>::update(double lr, Thread_pool *pool) {
+    T *data = storage_->data.data();
+    const T *grad = storage_->grad.data();
+    T step = static_cast<T>(lr);
+    size_t n = size();
+    auto axpy = [=](size_t begin, size_t end) {
+        for (size_t it = begin; it < end; ++it) {
+            data[it] -= step * grad[it];
+        }
     };
+    if (pool == nullptr || pool->size() == 1) {
+        axpy(0, n);
+        return;
+    }
+    size_t n_chunks = pool->size();
+    pool->run(n_chunks, [&](size_t chunk) {
+        axpy(n * chunk / n_chunks, n * (chunk + 1) / n_chunks);
+    });
+}
+
+template <typename T>
+struct Basic_value_handler<T>::Side {
+    explicit Side(std::pmr::vector<Value> values)
+        : operands(std::move(values)) {
+    }
+
+    // Operands of n-ary ops: lhs..., rhs..., then the bias if there is one.
+    std::pmr::vector<Value> operands;
+    std::shared_ptr<Basic_block<T>> block;
+    // Gradients of the block's outputs.
+    std::vector<T> out_grad;
+    std::string label;
+};
+
+// The side record lives in the resource of its operands, so that n-ary nodes
+// on a tape don't touch the heap.
+template <typename T>
+auto Basic_value_handler<T>::make_side(std::pmr::vector<Value> operands)
+    -> Side * {
+    std::pmr::polymorphic_allocator<Side> alloc(
+        operands.get_allocator().resource()
+    );
+    return alloc.template new_object<Side>(std::move(operands));
+}
+
+// Memory for the buffers of new nodes: the current tape if any.
+template <typename T>
+std::pmr::memory_resource *Basic_value_handler<T>::resource() {
+    Tape *tape = Tape::current();
+    return tape != nullptr ? &tape->arena_ : std::pmr::get_default_resource();
+}
+
+// Allocates the result node of an operation, on the current tape if any.
+template <typename T>
+template <typename... Args>
+auto Basic_value_handler<T>::allocate(Args &&...args) -> Value {
+    Tape *tape = Tape::current();
+    if (tape == nullptr) {
+        return std::make_shared<Basic_value_handler>(
+            std::forward<Args>(args)...
+        );
+    }
+    ++tape->n_nodes_;
+    return std::allocate_shared<Basic_value_handler>(
+        std::pmr::polymorphic_allocator<Basic_value_handler>(&tape->arena_),
+        std::forward<Args>(args)...
+    );
+}
+
+// Results of operations whose operands are all constant become constant
+// leaves: they need no backward rule and keep no references to the operands.
+template <typename T>
+auto Basic_value_handler<T>::constant(T data) -> Value {
+    Value res = allocate(data);
+    res->requires_grad_ = false;
     return res;
 }
 
-Value operator*(const Value &lhs, const Value &rhs) {
-    Value res = make_value(lhs->data_ * rhs->data_, {lhs, rhs});
-    Value_handler *weak_res = res.get();
-    res->backward_ = [weak_res]() {
-        weak_res->prev_[0]->grad_ +=
-            weak_res->prev_[1]->data_ * weak_res->grad_;
-        weak_res->prev_[1]->grad_ +=
-            weak_res->prev_[0]->data_ * weak_res->grad_;
+template <typename T>
+auto Basic_value_handler<T>::make_node(
+    Op op,
+    T data,
+    const Value &lhs,
+    const Value &rhs,
+    double param
+) -> Value {
+    if (!lhs->requires_grad_ && (!rhs || !rhs->requires_grad_)) {
+        return constant(data);
+    }
+    return allocate(op, data, lhs, rhs, param);
+}
+
+template <typename T>
+auto Basic_value_handler<T>::make_dot(
+    Op op,
+    const std::vector<Value> &lhs,
+    const std::vector<Value> &rhs,
+    const Value &bias
+) -> Value {
+    size_t n = lhs.size();
+    if (rhs.size() != n) {
+        throw std::invalid_argument("dot: operand sizes differ");
+    }
+    T sum = bias ? bias->data() : 0;
+    for (size_t it = 0; it < n; ++it) {
+        sum += lhs[it]->data() * rhs[it]->data();
+    }
+    if (op == Op::TANH_DOT) {
+        sum = std::tanh(sum);
+    }
+    auto requires_grad = [](const Value &value) {
+        return value->requires_grad_;
     };
+    if (!(bias && bias->requires_grad_) &&
+        std::none_of(lhs.begin(), lhs.end(), requires_grad) &&
+        std::none_of(rhs.begin(), rhs.end(), requires_grad)) {
+        return constant(sum);
+    }
+
+    std::pmr::vector<Value> operands(resource());
+    operands.reserve(2 * n + 1);
+    operands.insert(operands.end(), lhs.begin(), lhs.end());
+    operands.insert(operands.end(), rhs.begin(), rhs.end());
+    if (bias) {
+        operands.push_back(bias);
+    }
+    return allocate(op, sum, std::move(operands));
+}
+
+template <typename T>
+Basic_value<T> make_value(std::type_identity_t<T> data) {
+    return std::make_shared<Basic_value_handler<T>>(data);
+}
+
+template <typename T>
+Basic_value<T> make_value() {
+    return std::make_shared<Basic_value_handler<T>>();
+}
+
+template <typename T>
+Basic_value<T> make_constant(std::type_identity_t<T> data) {
+    Basic_value<T> res = std::make_shared<Basic_value_handler<T>>(data);
+    res->set_requires_grad(false);
     return res;
 }
 
-Value pow(const Value &arg, double k) {
-    Value res = make_value(std::pow(arg->data_, k), {arg});
-    Value_handler *weak_res = res.get();
-    res->backward_ = [weak_res, k]() {
-        weak_res->prev_[0]->grad_ +=
-            k * std::pow(weak_res->prev_[0]->data_, k - 1) * weak_res->grad_;
+template <typename T>
+Basic_value_handler<T>::Basic_value_handler()
+    : own_data_(static_cast<T>(random_uniform())) {
+    count();
+}
+
+template <typename T>
+Basic_value_handler<T>::Basic_value_handler(T data) : own_data_(data) {
+    count();
+}
+
+template <typename T>
+Basic_value_handler<T>::Basic_value_handler(
+    Op op,
+    T data,
+    Value lhs,
+    Value rhs,
+    double param
+)
+    : own_data_(data),
+      prev_{std::move(lhs), std::move(rhs)},
+      param_(param),
+      op_(op) {
+    count();
+}
+
+template <typename T>
+Basic_value_handler<T>::Basic_value_handler(
+    Op op,
+    T data,
+    std::pmr::vector<Value> operands
+)
+    : own_data_(data), side_(make_side(std::move(operands))), op_(op) {
+    count();
+}
+
+template <typename T>
+Basic_value_handler<T>::Basic_value_handler(T &data, T &grad)
+    : data_(&data), grad_(&grad) {
+    count();
+}
+
+// Dropping the last reference to a deep graph would otherwise recurse once
+// per node through the children's destructors. The outermost destructor
+// instead drains a worklist: every node destroyed meanwhile on this thread
+// only moves the children it solely owns onto it.
+template <typename T>
+Basic_value_handler<T>::~Basic_value_handler() {
+    if (profiled_) {
+        profile_node_destroyed();
+    }
+    if (op_ != Op::LEAF && teardown<T> != nullptr) {
+        unlink(*teardown<T>);
+    } else if (op_ != Op::LEAF) {
+        std::vector<Value> worklist;
+        teardown<T> = &worklist;
+        unlink(worklist);
+        while (!worklist.empty()) {
+            Value node = std::move(worklist.back());
+            worklist.pop_back();
+        }
+        teardown<T> = nullptr;
+    }
+    if (side_ != nullptr) {
+        std::pmr::polymorphic_allocator<Side> alloc(
+            side_->operands.get_allocator().resource()
+        );
+        alloc.delete_object(side_);
+    }
+}
+
+// Drops the children and the backward state once the node has propagated.
+// Children only this node still references are parked instead, since they
+// are still to propagate.
+template <typename T>
+void Basic_value_handler<T>::release(std::vector<Value> &parked) {
+    auto drop = [&](Value &child) {
+        if (child->op_ != Op::LEAF && child.use_count() == 1) {
+            child->mark_ = parked.size();
+            child->parked_ = true;
+            parked.push_back(std::move(child));
+        } else {
+            child.reset();
+        }
     };
-    return res;
+    for (Value &child : prev_) {
+        if (child) {
+            drop(child);
+        }
+    }
+    if (side_ != nullptr) {
+        for (Value &child : side_->operands) {
+            drop(child);
+        }
+        std::pmr::vector<Value>(side_->operands.get_allocator())
+            .swap(side_->operands);
+        side_->block.reset();
+        std::vector<T>().swap(side_->out_grad);
+    }
+    freed_ = true;
 }
 
-Value relu(const Value &arg) {
-    Value res = make_value(arg->data_ > 0 ? arg->data_ : 0, {arg});
-    Value_handler *weak_res = res.get();
-    res->backward_ = [weak_res]() {
-        weak_res->prev_[0]->grad_ +=
-            (weak_res->data_ > 0 ? 1 : 0) * weak_res->grad_;
+// Moves the children only this node references onto worklist.
+template <typename T>
+void Basic_value_handler<T>::unlink(std::vector<Value> &worklist) {
+    auto take = [&](Value &child) {
+        if (child.use_count() == 1 && child->op_ != Op::LEAF) {
+            worklist.push_back(std::move(child));
+        }
     };
-    return res;
+    for (Value &child : prev_) {
+        if (child) {
+            take(child);
+        }
+    }
+    for (Value &child : operands()) {
+        take(child);
+    }
 }
 
-Value tanh(const Value &arg) {
-    return (exp(2 * arg) - 1) / (exp(2 * arg) + 1);
+// Records the new node in the profile, if profiling.
+template <typename T>
+void Basic_value_handler<T>::count() {
+    if (!profiling()) {
+        return;
+    }
+    profiled_ = true;
+    size_t size = sizeof(Basic_value_handler);
+    if (side_ != nullptr) {
+        size += sizeof(Side) + side_->operands.capacity() * sizeof(Value);
+    }
+    profile_node_created(op_, size);
 }
 
-Value exp(const Value &arg) {
-    Value res = make_value(std::exp(arg->data_), {arg});
-    Value_handler *weak_res = res.get();
-    res->backward_ = [weak_res]() {
-        weak_res->prev_[0]->grad_ += weak_res->data_ * weak_res->grad_;
-    };
+template <typename T>
+auto Basic_value_handler<T>::children() const -> std::span<const Value> {
+    switch (op_) {
+        case Op::ADD:
+        case Op::SUB:
+        case Op::MUL:
+        case Op::DIV:
+            return {prev_.data(), 2};
+        case Op::SHIFT:
+        case Op::SCALE:
+        case Op::NEGATE:
+        case Op::POW:
+        case Op::RELU:
+        case Op::EXP:
+        case Op::LOG:
+        case Op::TANH:
+        case Op::SIGMOID:
+        case Op::GELU:
+        case Op::SOFTPLUS:
+        case Op::BLOCK_OUTPUT:
+            return {prev_.data(), 1};
+        case Op::DOT:
+        case Op::TANH_DOT:
+        case Op::BLOCK:
+            return side_->operands;
+        case Op::LEAF:
+            break;
+    }
+    return {};
+}
+
+template <typename T>
+auto Basic_value_handler<T>::operands() -> std::span<Value> {
+    return side_ != nullptr ? std::span<Value>(side_->operands)
+                            : std::span<Value>();
+}
+
+template <typename T>
+void Basic_value_handler<T>::propagate() {
+    Basic_value_handler *lhs = prev_[0].get();
+    Basic_value_handler *rhs = prev_[1].get();
+    T param = static_cast<T>(param_);
+    switch (op_) {
+        case Op::ADD:
+            lhs->grad() += grad();
+            rhs->grad() += grad();
+            break;
+        case Op::SUB:
+            lhs->grad() += grad();
+            rhs->grad() -= grad();
+            break;
+        case Op::MUL:
+            lhs->grad() += rhs->data() * grad();
+            rhs->grad() += lhs->data() * grad();
+            break;
+        case Op::DIV:
+            lhs->grad() += grad() / rhs->data();
+            rhs->grad() -= data() / rhs->data() * grad();
+            break;
+        case Op::SHIFT:
+            lhs->grad() += grad();
+            break;
+        case Op::SCALE:
+            lhs->grad() += param * grad();
+            break;
+        case Op::NEGATE:
+            lhs->grad() -= grad();
+            break;
+        case Op::POW:
+            lhs->grad() += param * std::pow(lhs->data(), param - 1) * grad();
+            break;
+        case Op::RELU:
+            lhs->grad() += (data() > 0 ? 1 : 0) * grad();
+            break;
+        case Op::EXP:
+            lhs->grad() += data() * grad();
+            break;
+        case Op::DOT:
+        case Op::TANH_DOT: {
+            T g = grad();
+            if (op_ == Op::TANH_DOT) {
+                g *= 1 - data() * data();
+            }
+            std::span<Value> ops = operands();
+            size_t n = ops.size() / 2;
+            const Value *x = ops.data();
+            const Value *w = x + n;
+            for (size_t it = 0; it < n; ++it) {
+                x[it]->grad() += w[it]->data() * g;
+                w[it]->grad() += x[it]->data() * g;
+            }
+            if (ops.size() % 2 == 1) {
+                ops.back()->grad() += g;
+            }
+            break;
+        }
+        case Op::BLOCK: {
+            std::span<Value> ops = operands();
+            std::vector<T> in(ops.size());
+            std::vector<T> in_grad(ops.size(), 0);
+            for (size_t it = 0; it < in.size(); ++it) {
+                in[it] = ops[it]->data();
+            }
+            side_->block->backward(in, side_->out_grad, in_grad);
+            for (size_t it = 0; it < in.size(); ++it) {
+                ops[it]->grad() += in_grad[it];
+            }
+            break;
+        }
+        case Op::BLOCK_OUTPUT:
+            lhs->side_->out_grad[static_cast<size_t>(param_)] += grad();
+            break;
+        case Op::LOG:
+            lhs->grad() += grad() / lhs->data();
+            break;
+        case Op::TANH:
+            lhs->grad() += (1 - data() * data()) * grad();
+            break;
+        case Op::SIGMOID:
+            lhs->grad() += data() * (1 - data()) * grad();
+            break;
+        case Op::GELU: {
+            T x = lhs->data();
+            lhs->grad() += (normal_cdf(x) + x * normal_pdf(x)) * grad();
+            break;
+        }
+        case Op::SOFTPLUS:
+            lhs->grad() += logistic(lhs->data()) * grad();
+            break;
+        case Op::LEAF:
+            break;
+    }
+}
+
+template <typename T>
+T Basic_value_handler<T>::get_data() const {
+    return *data_;
+}
+
+template <typename T>
+T Basic_value_handler<T>::get_grad() const {
+    return *grad_;
+}
+
+template <typename T>
+void Basic_value_handler<T>::set_data(T data) {
+    *data_ = data;
+}
+
+template <typename T>
+void Basic_value_handler<T>::set_grad(T grad) {
+    *grad_ = grad;
+}
+
+template <typename T>
+void Basic_value_handler<T>::zero_grad() {
+    *grad_ = 0;
+}
+
+template <typename T>
+void Basic_value_handler<T>::update(double lr) {
+    *data_ -= static_cast<T>(lr) * *grad_;
+}
+
+template <typename T>
+void Basic_value_handler<T>::set_label(std::string label) {
+    if (side_ == nullptr) {
+        side_ = make_side(
+            std::pmr::vector<Value>(std::pmr::get_default_resource())
+        );
+    }
+    side_->label = std::move(label);
+}
+
+template <typename T>
+bool Basic_value_handler<T>::requires_grad() const {
+    return requires_grad_;
+}
+
+template <typename T>
+void Basic_value_handler<T>::set_requires_grad(bool requires_grad) {
+    requires_grad_ = requires_grad;
+}
+
+template <typename T>
+Basic_value<T> operator+(const Basic_value<T> &lhs, const Basic_value<T> &rhs) {
+    return Basic_value_handler<T>::make_node(
+        Op::ADD, lhs->data() + rhs->data(), lhs, rhs
+    );
+}
+
+template <typename T>
+Basic_value<T> operator*(const Basic_value<T> &lhs, const Basic_value<T> &rhs) {
+    return Basic_value_handler<T>::make_node(
+        Op::MUL, lhs->data() * rhs->data(), lhs, rhs
+    );
+}
+
+template <typename T>
+Basic_value<T> pow(const Basic_value<T> &arg, double k) {
+    return Basic_value_handler<T>::make_node(
+        Op::POW, std::pow(arg->data(), static_cast<T>(k)), arg, nullptr, k
+    );
+}
+
+template <typename T>
+Basic_value<T> relu(const Basic_value<T> &arg) {
+    return Basic_value_handler<T>::make_node(
+        Op::RELU, arg->data() > 0 ? arg->data() : 0, arg
+    );
+}
+
+template <typename T>
+Basic_value<T> tanh(const Basic_value<T> &arg) {
+    return Basic_value_handler<T>::make_node(
+        Op::TANH, std::tanh(arg->data()), arg
+    );
+}
+
+template <typename T>
+Basic_value<T> exp(const Basic_value<T> &arg) {
+    return Basic_value_handler<T>::make_node(
+        Op::EXP, std::exp(arg->data()), arg
+    );
+}
+
+template <typename T>
+Basic_value<T> dot(
+    const std::vector<Basic_value<T>> &lhs,
+    const std::vector<Basic_value<T>> &rhs,
+    const Basic_value<T> &bias
+) {
+    return Basic_value_handler<T>::make_dot(Op::DOT, lhs, rhs, bias);
+}
+
+template <typename T>
+Basic_value<T> tanh_dot(
+    const std::vector<Basic_value<T>> &lhs,
+    const std::vector<Basic_value<T>> &rhs,
+    const Basic_value<T> &bias
+) {
+    return Basic_value_handler<T>::make_dot(Op::TANH_DOT, lhs, rhs, bias);
+}
+
+template <typename T>
+std::vector<Basic_value<T>> apply_block(
+    std::shared_ptr<Basic_block<std::type_identity_t<T>>> block,
+    const std::vector<Basic_value<T>> &inputs,
+    size_t n_outputs
+) {
+    using Handler = Basic_value_handler<T>;
+    std::vector<T> in(inputs.size());
+    for (size_t it = 0; it < in.size(); ++it) {
+        in[it] = inputs[it]->data();
+    }
+    std::vector<T> out(n_outputs);
+    block->forward(in, out);
+
+    std::vector<Basic_value<T>> res;
+    res.reserve(n_outputs);
+    if (std::none_of(
+            inputs.begin(), inputs.end(),
+            [](const Basic_value<T> &input) { return input->requires_grad_; }
+        )) {
+        for (T data : out) {
+            res.push_back(Handler::constant(data));
+        }
+        return res;
+    }
+
+    std::pmr::vector<Basic_value<T>> operands(
+        inputs.begin(), inputs.end(), Handler::resource()
+    );
+    Basic_value<T> hub =
+        Handler::allocate(Op::BLOCK, T(0), std::move(operands));
+    hub->side_->block = std::move(block);
+    hub->side_->out_grad.assign(n_outputs, 0);
+
+    for (size_t it = 0; it < n_outputs; ++it) {
+        res.push_back(Handler::make_node(
+            Op::BLOCK_OUTPUT, out[it], hub, nullptr, static_cast<double>(it)
+        ));
+    }
     return res;
 }
 
-Value operator-(const Value &arg) {
-    return arg * make_value(-1);
+template <typename T>
+Basic_value<T> log(const Basic_value<T> &arg) {
+    return Basic_value_handler<T>::make_node(
+        Op::LOG, std::log(arg->data()), arg
+    );
 }
 
-Value operator-(const Value &lhs, const Value &rhs) {
-    return lhs + (-rhs);
+template <typename T>
+Basic_value<T> sigmoid(const Basic_value<T> &arg) {
+    return Basic_value_handler<T>::make_node(
+        Op::SIGMOID, logistic(arg->data()), arg
+    );
+}
+
+template <typename T>
+Basic_value<T> gelu(const Basic_value<T> &arg) {
+    T x = arg->data();
+    return Basic_value_handler<T>::make_node(Op::GELU, x * normal_cdf(x), arg);
+}
+
+template <typename T>
+Basic_value<T> softplus(const Basic_value<T> &arg) {
+    // log(1 + e^x) without overflow for large x.
+    T x = arg->data();
+    return Basic_value_handler<T>::make_node(
+        Op::SOFTPLUS, std::max(x, T(0)) + std::log1p(std::exp(-std::abs(x))),
+        arg
+    );
 }
 
-Value operator/(const Value &lhs, const Value &rhs) {
-    return lhs * pow(rhs, -1);
+template <typename T>
+Basic_value<T> operator-(const Basic_value<T> &arg) {
+    return Basic_value_handler<T>::make_node(Op::NEGATE, -arg->data(), arg);
 }
 
-std::ostream &operator<<(std::ostream &os, const Value &value) {
-    os << "(" << value->data_ << " | " << value->grad_;
-    if (!value->label_.empty()) {
-        os << " | " << value->label_;
+template <typename T>
+Basic_value<T> operator-(const Basic_value<T> &lhs, const Basic_value<T> &rhs) {
+    return Basic_value_handler<T>::make_node(
+        Op::SUB, lhs->data() - rhs->data(), lhs, rhs
+    );
+}
+
+template <typename T>
+Basic_value<T> operator/(const Basic_value<T> &lhs, const Basic_value<T> &rhs) {
+    return Basic_value_handler<T>::make_node(
+        Op::DIV, lhs->data() / rhs->data(), lhs, rhs
+    );
+}
+
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_value<T> &value) {
+    os << "(" << value->data() << " | " << value->grad();
+    if (value->side_ != nullptr && !value->side_->label.empty()) {
+        os << " | " << value->side_->label;
     }
     os << ")";
     return os;
 }
 
-void backward(const Value &value) {
-    std::unordered_set<Value> visited;
-    std::vector<Value> order;
+template <typename T>
+void backward(const Basic_value<T> &value, bool retain_graph) {
+    thread_local Basic_topo_order<T> order;
+    backward(value, order, retain_graph);
+}
 
-    Value_handler::top_sort(value, visited, order);
+template <typename T>
+void backward(
+    const Basic_value<T> &value,
+    Basic_topo_order<T> &order,
+    bool retain_graph
+) {
+    using Handler = Basic_value_handler<T>;
+    Profile_scope sort_scope(Phase::SORT);
+    const std::vector<Handler *> &nodes = order.sort(value);
+    sort_scope.stop();
 
-    value->grad_ = 1;
-    std::for_each(order.rbegin(), order.rend(), [](const Value &node) {
-        if (node->backward_) {
-            node->backward_();
+    Profile_scope sweep_scope(Phase::BACKWARD);
+    // Intermediate gradients left by an earlier retained sweep would
+    // otherwise be propagated twice.
+    for (Handler *node : nodes) {
+        node->grad() = 0;
+        if (node->op_ == Op::BLOCK) {
+            std::fill(
+                node->side_->out_grad.begin(), node->side_->out_grad.end(), 0
+            );
         }
-    });
+    }
+    value->grad() = 1;
+    if (retain_graph) {
+        std::for_each(nodes.rbegin(), nodes.rend(), [](Handler *node) {
+            node->propagate();
+        });
+        return;
+    }
+    // Every parent of a node propagates before it, so once a node is done
+    // nothing in the graph needs it anymore. A node only the graph references
+    // is parked by its last parent and dies right after its own propagation.
+    std::vector<Basic_value<T>> &parked = order.parked_;
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+        Handler *node = *it;
+        node->propagate();
+        Basic_value<T> self;
+        if (node->parked_) {
+            self = std::move(parked[node->mark_]);
+        }
+        node->release(parked);
+    }
+    parked.clear();
+    order.root_ = nullptr;
 }
 
-void Value_handler::top_sort(
-    const Value &value,
-    std::unordered_set<Value> &visited,
-    std::vector<Value> &order
-) {
-    visited.insert(value);
-    for (const Value &child : value->prev_) {
-        if (visited.find(child) == visited.end()) {
-            top_sort(child, visited, order);
+template <typename T>
+auto Basic_topo_order<T>::sort(const Value &root)
+    -> const std::vector<Value_handler *> & {
+    if (root.get() == root_ && root->mark_ == epoch_) {
+        return order_;
+    }
+    order_.clear();
+    root_ = nullptr;
+    if (root->freed_) {
+        throw std::logic_error(FREED_GRAPH);
+    }
+    if (root->op_ == Op::LEAF) {
+        return order_;
+    }
+
+    // Iterative DFS: leaves are never pushed or marked, since they have
+    // nothing to propagate.
+    epoch_ = sort_epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+    root->mark_ = epoch_;
+    stack_.emplace_back(root.get(), 0);
+    while (!stack_.empty()) {
+        auto &[node, next] = stack_.back();
+        std::span<const Value> children = node->children();
+        if (next == children.size()) {
+            order_.push_back(node);
+            stack_.pop_back();
+            continue;
+        }
+        Value_handler *child = children[next++].get();
+        if (child->freed_) {
+            stack_.clear();
+            throw std::logic_error(FREED_GRAPH);
+        }
+        if (child->op_ != Op::LEAF && child->mark_ != epoch_) {
+            child->mark_ = epoch_;
+            stack_.emplace_back(child, 0);
+        }
+    }
+    root_ = root.get();
+    return order_;
+}
+
+template <typename T>
+Basic_plan<T>::Basic_plan(
+    const std::vector<Value> &inputs,
+    const std::vector<Value> &outputs
+)
+    : n_inputs_(inputs.size()) {
+    using Handler = Basic_value_handler<T>;
+    std::unordered_map<Handler *, size_t> slots;
+    for (const Value &input : inputs) {
+        if (input->op_ != Op::LEAF || !input->requires_grad_) {
+            throw std::invalid_argument(
+                "Plan: inputs must be leaves that require gradients"
+            );
+        }
+        slots.emplace(input.get(), slots.size());
+    }
+
+    // Iterative DFS from every output: leaves get a slot when first reached,
+    // other nodes get one instruction after all of their children.
+    std::unordered_map<Handler *, size_t> hubs;
+    std::vector<std::pair<Handler *, size_t>> stack;
+    auto visit = [&](const Value &value) {
+        if (value->freed_) {
+            throw std::logic_error(FREED_GRAPH);
+        }
+        if (slots.contains(value.get())) {
+            return;
+        }
+        if (value->op_ == Op::LEAF) {
+            bound_.push_back(value);
+            bound_slots_.push_back(slots.size());
+            slots.emplace(value.get(), slots.size());
+            return;
+        }
+        stack.emplace_back(value.get(), 0);
+    };
+    for (const Value &output : outputs) {
+        visit(output);
+        while (!stack.empty()) {
+            auto &[node, next] = stack.back();
+            std::span<const Value> children = node->children();
+            if (next < children.size()) {
+                visit(children[next++]);
+                continue;
+            }
+            Instruction inst{
+                node->op_, slots.size(), 0, 0, node->param_, 0, 0, 0
+            };
+            if (node->op_ == Op::DOT || node->op_ == Op::TANH_DOT ||
+                node->op_ == Op::BLOCK) {
+                inst.begin = operands_.size();
+                for (const Value &child : children) {
+                    operands_.push_back(slots.at(child.get()));
+                }
+                inst.end = operands_.size();
+            } else {
+                inst.lhs = slots.at(children[0].get());
+                if (children.size() > 1) {
+                    inst.rhs = slots.at(children[1].get());
+                }
+            }
+            if (node->op_ == Op::BLOCK) {
+                size_t n_in = children.size();
+                size_t n_out = node->side_->out_grad.size();
+                inst.block = blocks_.size();
+                hubs.emplace(node, inst.block);
+                blocks_.push_back(Block_slot{
+                    node->side_->block->clone(), std::vector<T>(n_in),
+                    std::vector<T>(n_in), std::vector<T>(n_out),
+                    std::vector<T>(n_out)
+                });
+            }
+            if (node->op_ == Op::BLOCK_OUTPUT) {
+                inst.block = hubs.at(children[0].get());
+            }
+            slots.emplace(node, slots.size());
+            code_.push_back(inst);
+            stack.pop_back();
+        }
+        output_slots_.push_back(slots.at(output.get()));
+    }
+    output_.resize(outputs.size());
+    data_.resize(slots.size());
+    grad_.resize(slots.size());
+}
+
+template <typename T>
+size_t Basic_plan<T>::size() const {
+    return code_.size();
+}
+
+template <typename T>
+void Basic_plan<T>::forward(std::span<const T> input) {
+    if (input.size() != n_inputs_) {
+        throw std::invalid_argument("Plan: input size differs from trace");
+    }
+    std::copy(input.begin(), input.end(), data_.begin());
+    for (size_t it = 0; it < bound_.size(); ++it) {
+        data_[bound_slots_[it]] = bound_[it]->data();
+    }
+    T *data = data_.data();
+    for (const Instruction &inst : code_) {
+        T x = data[inst.lhs];
+        T y = data[inst.rhs];
+        T param = static_cast<T>(inst.param);
+        T &res = data[inst.out];
+        switch (inst.op) {
+            case Op::ADD:
+                res = x + y;
+                break;
+            case Op::SUB:
+                res = x - y;
+                break;
+            case Op::MUL:
+                res = x * y;
+                break;
+            case Op::DIV:
+                res = x / y;
+                break;
+            case Op::SHIFT:
+                res = x + param;
+                break;
+            case Op::SCALE:
+                res = x * param;
+                break;
+            case Op::NEGATE:
+                res = -x;
+                break;
+            case Op::POW:
+                res = std::pow(x, param);
+                break;
+            case Op::RELU:
+                res = x > 0 ? x : 0;
+                break;
+            case Op::EXP:
+                res = std::exp(x);
+                break;
+            case Op::DOT:
+            case Op::TANH_DOT: {
+                size_t n = (inst.end - inst.begin) / 2;
+                const size_t *ops = operands_.data() + inst.begin;
+                T sum = 2 * n < inst.end - inst.begin ? data[ops[2 * n]] : 0;
+                for (size_t it = 0; it < n; ++it) {
+                    sum += data[ops[it]] * data[ops[n + it]];
+                }
+                res = inst.op == Op::TANH_DOT ? std::tanh(sum) : sum;
+                break;
+            }
+            case Op::BLOCK: {
+                Block_slot &blk = blocks_[inst.block];
+                for (size_t it = inst.begin; it < inst.end; ++it) {
+                    blk.in[it - inst.begin] = data[operands_[it]];
+                }
+                blk.block->forward(blk.in, blk.out);
+                res = 0;
+                break;
+            }
+            case Op::BLOCK_OUTPUT:
+                res = blocks_[inst.block].out[static_cast<size_t>(inst.param)];
+                break;
+            case Op::LOG:
+                res = std::log(x);
+                break;
+            case Op::TANH:
+                res = std::tanh(x);
+                break;
+            case Op::SIGMOID:
+                res = logistic(x);
+                break;
+            case Op::GELU:
+                res = x * normal_cdf(x);
+                break;
+            case Op::SOFTPLUS:
+                res = std::max(x, T(0)) + std::log1p(std::exp(-std::abs(x)));
+                break;
+            case Op::LEAF:
+                break;
         }
     }
-    order.push_back(value);
+    for (size_t it = 0; it < output_.size(); ++it) {
+        output_[it] = data[output_slots_[it]];
+    }
 }
 
-Value operator+(double lhs, const Value &rhs) {
-    return make_value(lhs) + rhs;
+template <typename T>
+std::span<const T> Basic_plan<T>::output() const {
+    return output_;
 }
 
-Value operator-(double lhs, const Value &rhs) {
-    return make_value(lhs) - rhs;
+template <typename T>
+void Basic_plan<T>::backward(std::span<const T> output_grad) {
+    if (output_grad.size() != output_.size()) {
+        throw std::invalid_argument("Plan: gradient size differs from output");
+    }
+    std::fill(grad_.begin(), grad_.end(), 0);
+    for (Block_slot &blk : blocks_) {
+        std::fill(blk.out_grad.begin(), blk.out_grad.end(), 0);
+    }
+    for (size_t it = 0; it < output_grad.size(); ++it) {
+        grad_[output_slots_[it]] += output_grad[it];
+    }
+    const T *data = data_.data();
+    T *grad = grad_.data();
+    for (auto inst = code_.rbegin(); inst != code_.rend(); ++inst) {
+        T out = data[inst->out];
+        T g = grad[inst->out];
+        T x = data[inst->lhs];
+        T param = static_cast<T>(inst->param);
+        T &dx = grad[inst->lhs];
+        T &dy = grad[inst->rhs];
+        switch (inst->op) {
+            case Op::ADD:
+                dx += g;
+                dy += g;
+                break;
+            case Op::SUB:
+                dx += g;
+                dy -= g;
+                break;
+            case Op::MUL:
+                dx += data[inst->rhs] * g;
+                dy += x * g;
+                break;
+            case Op::DIV:
+                dx += g / data[inst->rhs];
+                dy -= out / data[inst->rhs] * g;
+                break;
+            case Op::SHIFT:
+                dx += g;
+                break;
+            case Op::SCALE:
+                dx += param * g;
+                break;
+            case Op::NEGATE:
+                dx -= g;
+                break;
+            case Op::POW:
+                dx += param * std::pow(x, param - 1) * g;
+                break;
+            case Op::RELU:
+                dx += (out > 0 ? 1 : 0) * g;
+                break;
+            case Op::EXP:
+                dx += out * g;
+                break;
+            case Op::DOT:
+            case Op::TANH_DOT: {
+                if (inst->op == Op::TANH_DOT) {
+                    g *= 1 - out * out;
+                }
+                size_t n = (inst->end - inst->begin) / 2;
+                const size_t *ops = operands_.data() + inst->begin;
+                for (size_t it = 0; it < n; ++it) {
+                    grad[ops[it]] += data[ops[n + it]] * g;
+                    grad[ops[n + it]] += data[ops[it]] * g;
+                }
+                if (2 * n < inst->end - inst->begin) {
+                    grad[ops[2 * n]] += g;
+                }
+                break;
+            }
+            case Op::BLOCK: {
+                Block_slot &blk = blocks_[inst->block];
+                std::fill(blk.in_grad.begin(), blk.in_grad.end(), 0);
+                blk.block->backward(blk.in, blk.out_grad, blk.in_grad);
+                for (size_t it = inst->begin; it < inst->end; ++it) {
+                    grad[operands_[it]] += blk.in_grad[it - inst->begin];
+                }
+                break;
+            }
+            case Op::BLOCK_OUTPUT:
+                blocks_[inst->block]
+                    .out_grad[static_cast<size_t>(inst->param)] += g;
+                break;
+            case Op::LOG:
+                dx += g / x;
+                break;
+            case Op::TANH:
+                dx += (1 - out * out) * g;
+                break;
+            case Op::SIGMOID:
+                dx += out * (1 - out) * g;
+                break;
+            case Op::GELU:
+                dx += (normal_cdf(x) + x * normal_pdf(x)) * g;
+                break;
+            case Op::SOFTPLUS:
+                dx += logistic(x) * g;
+                break;
+            case Op::LEAF:
+                break;
+        }
+    }
+    for (size_t it = 0; it < bound_.size(); ++it) {
+        bound_[it]->grad() += grad[bound_slots_[it]];
+    }
 }
 
-Value operator*(double lhs, const Value &rhs) {
-    return make_value(lhs) * rhs;
+template <typename T>
+std::span<const T> Basic_plan<T>::input_grad() const {
+    return std::span<const T>(grad_).first(n_inputs_);
 }
 
-Value operator/(double lhs, const Value &rhs) {
-    return make_value(lhs) / rhs;
+// Scalar operands are folded into SHIFT and SCALE nodes instead of becoming
+// constant leaves of the graph.
+template <typename T>
+Basic_value<T> operator+(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+) {
+    return rhs + lhs;
 }
 
-Value operator+(const Value &lhs, double rhs) {
-    return lhs + make_value(rhs);
+template <typename T>
+Basic_value<T> operator-(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+) {
+    return (-rhs) + lhs;
 }
 
-Value operator-(const Value &lhs, double rhs) {
-    return lhs - make_value(rhs);
+template <typename T>
+Basic_value<T> operator*(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+) {
+    return rhs * lhs;
 }
 
-Value operator*(const Value &lhs, double rhs) {
-    return lhs * make_value(rhs);
+template <typename T>
+Basic_value<T> operator/(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+) {
+    return pow(rhs, -1) * lhs;
 }
 
-Value operator/(const Value &lhs, double rhs) {
-    return lhs / make_value(rhs);
+template <typename T>
+Basic_value<T> operator+(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+) {
+    return Basic_value_handler<T>::make_node(
+        Op::SHIFT, lhs->data() + rhs, lhs, nullptr, rhs
+    );
 }
+
+template <typename T>
+Basic_value<T> operator-(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+) {
+    return lhs + (-rhs);
+}
+
+template <typename T>
+Basic_value<T> operator*(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+) {
+    return Basic_value_handler<T>::make_node(
+        Op::SCALE, lhs->data() * rhs, lhs, nullptr, rhs
+    );
+}
+
+template <typename T>
+Basic_value<T> operator/(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+) {
+    return lhs * (1 / rhs);
+}
+
+#define INSTANTIATE(T)                                                        \
+    template class Basic_value_handler<T>;                                    \
+    template class Basic_topo_order<T>;                                       \
+    template class Basic_plan<T>;                                             \
+    template class Basic_parameter_buffer<T>;                                 \
+    template Basic_value<T> make_value<T>(T);                                 \
+    template Basic_value<T> make_value<T>();                                  \
+    template Basic_value<T> make_constant<T>(T);                              \
+    template void backward(const Basic_value<T> &, bool);                     \
+    template void backward(                                                   \
+        const Basic_value<T> &, Basic_topo_order<T> &, bool                   \
+    );                                                                        \
+    template std::vector<Basic_value<T>> apply_block(                         \
+        std::shared_ptr<Basic_block<T>>, const std::vector<Basic_value<T>> &, \
+        size_t                                                                \
+    );                                                                        \
+    template Basic_value<T> dot(                                              \
+        const std::vector<Basic_value<T>> &,                                  \
+        const std::vector<Basic_value<T>> &, const Basic_value<T> &           \
+    );                                                                        \
+    template Basic_value<T> tanh_dot(                                         \
+        const std::vector<Basic_value<T>> &,                                  \
+        const std::vector<Basic_value<T>> &, const Basic_value<T> &           \
+    );                                                                        \
+    template Basic_value<T> operator+(                                        \
+        const Basic_value<T> &, const Basic_value<T> &                        \
+    );                                                                        \
+    template Basic_value<T> operator-(                                        \
+        const Basic_value<T> &, const Basic_value<T> &                        \
+    );                                                                        \
+    template Basic_value<T> operator*(                                        \
+        const Basic_value<T> &, const Basic_value<T> &                        \
+    );                                                                        \
+    template Basic_value<T> operator/(                                        \
+        const Basic_value<T> &, const Basic_value<T> &                        \
+    );                                                                        \
+    template Basic_value<T> operator+ <T>(T, const Basic_value<T> &);         \
+    template Basic_value<T> operator- <T>(T, const Basic_value<T> &);         \
+    template Basic_value<T> operator* <T>(T, const Basic_value<T> &);         \
+    template Basic_value<T> operator/ <T>(T, const Basic_value<T> &);         \
+    template Basic_value<T> operator+ <T>(const Basic_value<T> &, T);         \
+    template Basic_value<T> operator- <T>(const Basic_value<T> &, T);         \
+    template Basic_value<T> operator* <T>(const Basic_value<T> &, T);         \
+    template Basic_value<T> operator/ <T>(const Basic_value<T> &, T);         \
+    template Basic_value<T> operator-(const Basic_value<T> &);                \
+    template Basic_value<T> pow(const Basic_value<T> &, double);              \
+    template Basic_value<T> relu(const Basic_value<T> &);                     \
+    template Basic_value<T> tanh(const Basic_value<T> &);                     \
+    template Basic_value<T> exp(const Basic_value<T> &);                      \
+    template Basic_value<T> log(const Basic_value<T> &);                      \
+    template Basic_value<T> sigmoid(const Basic_value<T> &);                  \
+    template Basic_value<T> gelu(const Basic_value<T> &);                     \
+    template Basic_value<T> softplus(const Basic_value<T> &);                 \
+    template std::ostream &operator<<(std::ostream &, const Basic_value<T> &);
+
+INSTANTIATE(float)
+INSTANTIATE(double)
+#undef INSTANTIATE
+
 }  // namespace nn
@@ -1,67 +1,538 @@
 #pragma once
 
-#include <functional>
+#include <array>
+#include <cstdint>
+#include <iosfwd>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
 #include <string>
-#include <unordered_set>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace nn {
 
-class Value_handler;
-using Value = std::shared_ptr<Value_handler>;
-Value make_value(double data, std::vector<Value> childs = {});
-Value make_value();
-void backward(const Value &value);
+// The scalar graph is templated on its scalar type T and instantiated for
+// float and double; Value and the other unprefixed names are the double
+// versions. Scalar operands of the mixed operators and make_value() take a
+// std::type_identity_t<T>, so they convert to the graph's type instead of
+// taking part in deduction.
+class Thread_pool;
+template <typename T>
+class Basic_value_handler;
+template <typename T>
+class Basic_topo_order;
+template <typename T>
+class Basic_block;
+enum class Op : uint8_t;
+template <typename T>
+using Basic_value = std::shared_ptr<Basic_value_handler<T>>;
+using Value_handler = Basic_value_handler<double>;
+using Value = Basic_value<double>;
 
-class Value_handler {
+template <typename T = double>
+Basic_value<T> make_value(std::type_identity_t<T> data);
+template <typename T = double>
+Basic_value<T> make_value();
+// Leaf that doesn't require a gradient, e.g. an input or a target. Results of
+// operations on constants only are constant leaves themselves, so backward
+// never visits them.
+template <typename T = double>
+Basic_value<T> make_constant(std::type_identity_t<T> data);
+// Adds the gradients of value to every node of its graph. Unless retain_graph
+// is set, each node drops its children and backward state as soon as its own
+// gradient has been propagated, so intermediate nodes nobody else references
+// are freed during the sweep; running backward again over the freed graph
+// throws std::logic_error. Each pass over a retained graph, blocks included,
+// adds exactly one more set of gradients to the leaves.
+template <typename T>
+void backward(const Basic_value<T> &value, bool retain_graph = false);
+template <typename T>
+void backward(
+    const Basic_value<T> &value,
+    Basic_topo_order<T> &order,
+    bool retain_graph = false
+);
+
+// Reusable topological order of a graph. Sorting the same root again returns
+// the cached order, e.g. for repeated retained backward passes. Across training
+// steps only the buffers are reused: every step builds new nodes, and finding
+// them is the traversal sorting does anyway, so a graph of unchanged shape is
+// sorted again but without reallocating. A freeing backward drops the cache.
+// To skip the graph entirely for a fixed shape, trace it into a Plan.
+template <typename T>
+class Basic_topo_order {
+public:
+    using Value_handler = Basic_value_handler<T>;
+    using Value = Basic_value<T>;
+
+    // Nodes with children reachable from root, children before parents.
+    // Throws std::logic_error if backward has freed any of them.
+    const std::vector<Value_handler *> &sort(const Value &root);
+
+private:
+    Value_handler *root_ = nullptr;
+    uint64_t epoch_ = 0;
+    std::vector<Value_handler *> order_;
+    std::vector<std::pair<Value_handler *, size_t>> stack_;
+    // Nodes kept alive by a freeing backward until their own propagation.
+    std::vector<Value> parked_;
+
+    template <typename U>
+    friend void backward(
+        const Basic_value<U> &value,
+        Basic_topo_order<U> &order,
+        bool retain_graph
+    );
+};
+
+using Topo_order = Basic_topo_order<double>;
+
+// Multi-output computation evaluated outside the scalar graph, e.g. over
+// contiguous buffers. One Block instance is used for one application and may
+// keep whatever forward state its backward needs.
+template <typename T>
+class Basic_block {
+public:
+    virtual ~Basic_block() = default;
+    // Computes the outputs from the input data.
+    virtual void forward(std::span<const T> in, std::span<T> out) = 0;
+    // Adds the input gradients for the given output gradients to in_grad.
+    virtual void backward(
+        std::span<const T> in,
+        std::span<const T> out_grad,
+        std::span<T> in_grad
+    ) = 0;
+    // New block computing the same function, without any forward state. A
+    // Plan replays its own clones, so the traced graph's blocks keep theirs.
+    virtual std::shared_ptr<Basic_block<T>> clone() const = 0;
+};
+
+using Block = Basic_block<double>;
+
+// Runs block over inputs and returns its n_outputs results. The graph gets one
+// hub node over all inputs plus one node per output reading from it, so the
+// block's backward runs once, after every output has received its gradient.
+template <typename T>
+std::vector<Basic_value<T>> apply_block(
+    std::shared_ptr<Basic_block<std::type_identity_t<T>>> block,
+    const std::vector<Basic_value<T>> &inputs,
+    size_t n_outputs
+);
+
+// sum(lhs[i] * rhs[i]) + bias as a single node; bias may be null.
+template <typename T = double>
+Basic_value<T> dot(
+    const std::vector<Basic_value<T>> &lhs,
+    const std::vector<Basic_value<T>> &rhs,
+    const Basic_value<T> &bias = nullptr
+);
+// tanh(dot(lhs, rhs, bias)) as a single node.
+template <typename T = double>
+Basic_value<T> tanh_dot(
+    const std::vector<Basic_value<T>> &lhs,
+    const std::vector<Basic_value<T>> &rhs,
+    const Basic_value<T> &bias = nullptr
+);
+
+template <typename T>
+Basic_value<T> operator+(const Basic_value<T> &lhs, const Basic_value<T> &rhs);
+template <typename T>
+Basic_value<T> operator-(const Basic_value<T> &lhs, const Basic_value<T> &rhs);
+template <typename T>
+Basic_value<T> operator*(const Basic_value<T> &lhs, const Basic_value<T> &rhs);
+template <typename T>
+Basic_value<T> operator/(const Basic_value<T> &lhs, const Basic_value<T> &rhs);
+
+template <typename T>
+Basic_value<T> operator+(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+);
+template <typename T>
+Basic_value<T> operator-(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+);
+template <typename T>
+Basic_value<T> operator*(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+);
+template <typename T>
+Basic_value<T> operator/(
+    std::type_identity_t<T> lhs,
+    const Basic_value<T> &rhs
+);
+template <typename T>
+Basic_value<T> operator+(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+);
+template <typename T>
+Basic_value<T> operator-(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+);
+template <typename T>
+Basic_value<T> operator*(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+);
+template <typename T>
+Basic_value<T> operator/(
+    const Basic_value<T> &lhs,
+    std::type_identity_t<T> rhs
+);
+
+template <typename T>
+Basic_value<T> operator-(const Basic_value<T> &arg);
+
+template <typename T>
+Basic_value<T> pow(const Basic_value<T> &arg, double k);
+template <typename T>
+Basic_value<T> relu(const Basic_value<T> &arg);
+template <typename T>
+Basic_value<T> tanh(const Basic_value<T> &arg);
+template <typename T>
+Basic_value<T> exp(const Basic_value<T> &arg);
+template <typename T>
+Basic_value<T> log(const Basic_value<T> &arg);
+template <typename T>
+Basic_value<T> sigmoid(const Basic_value<T> &arg);
+template <typename T>
+Basic_value<T> gelu(const Basic_value<T> &arg);
+template <typename T>
+Basic_value<T> softplus(const Basic_value<T> &arg);
+
+template <typename T>
+std::ostream &operator<<(std::ostream &os, const Basic_value<T> &value);
+
+// Static execution plan of a graph whose shape doesn't change between steps.
+// Tracing the graph once turns it into a linear instruction list over
+// preallocated data and gradient slots, which is then replayed for new input
+// values without building any nodes.
+template <typename T>
+class Basic_plan {
+public:
+    using Value = Basic_value<T>;
+
+    // Traces the graph from the input leaves, which must require gradients,
+    // to the outputs. Every other leaf reached, e.g. a parameter, is bound:
+    // forward reads its current data and backward adds to its gradient.
+    Basic_plan(
+        const std::vector<Value> &inputs,
+        const std::vector<Value> &outputs
+    );
+
+    // Number of instructions.
+    size_t size() const;
+    // Evaluates the outputs for the given input values.
+    void forward(std::span<const T> input);
+    std::span<const T> output() const;
+    // Reverse pass for the given output gradients after forward. Adds the
+    // gradients of the bound leaves to them; the input gradients are left in
+    // input_grad().
+    void backward(std::span<const T> output_grad);
+    std::span<const T> input_grad() const;
+
+private:
+    struct Instruction {
+        Op op;
+        size_t out;
+        size_t lhs;
+        size_t rhs;
+        double param;
+        // Operands of n-ary ops, a range of operands_.
+        size_t begin;
+        size_t end;
+        // Index in blocks_ of a BLOCK or BLOCK_OUTPUT.
+        size_t block;
+    };
+    struct Block_slot {
+        std::shared_ptr<Basic_block<T>> block;
+        std::vector<T> in;
+        std::vector<T> in_grad;
+        std::vector<T> out;
+        std::vector<T> out_grad;
+    };
+
+    size_t n_inputs_;
+    std::vector<Instruction> code_;
+    std::vector<size_t> operands_;
+    std::vector<Block_slot> blocks_;
+    std::vector<Value> bound_;
+    std::vector<size_t> bound_slots_;
+    std::vector<size_t> output_slots_;
+    std::vector<T> output_;
+    std::vector<T> data_;
+    std::vector<T> grad_;
+};
+
+using Plan = Basic_plan<double>;
+
+// Per-step arena for graph nodes. While a Tape is alive, every node produced
+// by an operation on the current thread is bump-allocated from it, and all of
+// them are released at once when the tape is destroyed. Leaves created by
+// make_value() or make_constant() (e.g. parameters) are always heap-allocated
+// and outlive tapes.
+// Values built on a tape must be dropped before the tape itself.
+class Tape {
+public:
+    explicit Tape(size_t initial_bytes = 1 << 16);
+    ~Tape();
+    Tape(const Tape &) = delete;
+    Tape &operator=(const Tape &) = delete;
+
+    // Number of nodes allocated on this tape so far.
+    size_t size() const;
+
+    // Innermost live tape of the calling thread, or nullptr.
+    static Tape *current();
+
+private:
+    std::pmr::monotonic_buffer_resource arena_;
+    Tape *outer_;
+    size_t n_nodes_ = 0;
+
+    static thread_local Tape *current_;
+
+    template <typename T>
+    friend class Basic_value_handler;
+};
+
+// Leaves whose data and gradients live in two contiguous arrays, so that
+// zeroing the gradients is one memset and a gradient step is one axpy. Copies
+// share the same storage, and every handle from values() keeps it alive.
+template <typename T>
+class Basic_parameter_buffer {
+public:
+    using Value = Basic_value<T>;
+
+    explicit Basic_parameter_buffer(std::span<const T> data);
+    // Views data in place instead of copying it, e.g. a memory-mapped file,
+    // and keeps owner alive as long as the storage.
+    Basic_parameter_buffer(std::span<T> data, std::shared_ptr<void> owner);
+
+    size_t size() const;
+    std::span<T> data() const;
+    std::span<T> grad() const;
+    // Leaf i views data()[i] and grad()[i].
+    const Value &operator[](size_t index) const;
+    std::vector<Value> values() const;
+
+    void zero_grad();
+    // data -= lr * grad, split across pool if any.
+    void update(double lr, Thread_pool *pool = nullptr);
+
+private:
+    struct Storage;
+    std::shared_ptr<Storage> storage_;
+    std::vector<Value> values_;
+
+    void bind();
+};
+
+using Parameter_buffer = Basic_parameter_buffer<double>;
+
+// Operation that produced a node; selects its backward rule.
+enum class Op : uint8_t {
+    LEAF,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    SHIFT,
+    SCALE,
+    NEGATE,
+    POW,
+    RELU,
+    EXP,
+    DOT,
+    TANH_DOT,
+    BLOCK,
+    BLOCK_OUTPUT,
+    LOG,
+    TANH,
+    SIGMOID,
+    GELU,
+    SOFTPLUS
+};
+
+template <typename T>
+class Basic_value_handler {
 public:
-    Value_handler();
-    Value_handler(double data, std::vector<Value> childs);
-    double get_data() const;
-    double get_grad() const;
+    using Value = Basic_value<T>;
+
+    Basic_value_handler();
+    explicit Basic_value_handler(T data);
+    Basic_value_handler(Op op, T data, Value lhs, Value rhs, double param);
+    Basic_value_handler(Op op, T data, std::pmr::vector<Value> operands);
+    // Leaf whose data and gradient are stored outside the node.
+    Basic_value_handler(T &data, T &grad);
+    ~Basic_value_handler();
+    Basic_value_handler(const Basic_value_handler &) = delete;
+    Basic_value_handler &operator=(const Basic_value_handler &) = delete;
+    T get_data() const;
+    T get_grad() const;
+    void set_data(T data);
+    void set_grad(T grad);
     void zero_grad();
     void update(double lr);
     void set_label(std::string label);
+    // Whether gradients flow into this node. Only affects nodes built after
+    // it changes.
+    bool requires_grad() const;
+    void set_requires_grad(bool requires_grad);
 
-    friend void backward(const Value &value);
-    friend Value operator+(const Value &lhs, const Value &rhs);
-    friend Value operator-(const Value &lhs, const Value &rhs);
-    friend Value operator*(const Value &lhs, const Value &rhs);
-    friend Value operator/(const Value &lhs, const Value &rhs);
+    template <typename U>
+    friend void backward(
+        const Basic_value<U> &value,
+        Basic_topo_order<U> &order,
+        bool retain_graph
+    );
+    template <typename U>
+    friend Basic_value<U> operator+(
+        const Basic_value<U> &lhs,
+        const Basic_value<U> &rhs
+    );
+    template <typename U>
+    friend Basic_value<U> operator-(
+        const Basic_value<U> &lhs,
+        const Basic_value<U> &rhs
+    );
+    template <typename U>
+    friend Basic_value<U> operator*(
+        const Basic_value<U> &lhs,
+        const Basic_value<U> &rhs
+    );
+    template <typename U>
+    friend Basic_value<U> operator/(
+        const Basic_value<U> &lhs,
+        const Basic_value<U> &rhs
+    );
 
-    friend Value operator+(double lhs, const Value &rhs);
-    friend Value operator-(double lhs, const Value &rhs);
-    friend Value operator*(double lhs, const Value &rhs);
-    friend Value operator/(double lhs, const Value &rhs);
-    friend Value operator+(const Value &lhs, double rhs);
-    friend Value operator-(const Value &lhs, double rhs);
-    friend Value operator*(const Value &lhs, double rhs);
-    friend Value operator/(const Value &lhs, double rhs);
+    template <typename U>
+    friend Basic_value<U> operator+(
+        const Basic_value<U> &lhs,
+        std::type_identity_t<U> rhs
+    );
+    template <typename U>
+    friend Basic_value<U> operator*(
+        const Basic_value<U> &lhs,
+        std::type_identity_t<U> rhs
+    );
 
-    friend Value operator-(const Value &arg);
+    template <typename U>
+    friend Basic_value<U> operator-(const Basic_value<U> &arg);
 
-    friend Value pow(const Value &arg, double k);
-    friend Value relu(const Value &arg);
-    friend Value tanh(const Value &arg);
-    friend Value exp(const Value &arg);
+    template <typename U>
+    friend Basic_value<U> pow(const Basic_value<U> &arg, double k);
+    template <typename U>
+    friend Basic_value<U> relu(const Basic_value<U> &arg);
+    template <typename U>
+    friend Basic_value<U> tanh(const Basic_value<U> &arg);
+    template <typename U>
+    friend Basic_value<U> exp(const Basic_value<U> &arg);
+    template <typename U>
+    friend Basic_value<U> dot(
+        const std::vector<Basic_value<U>> &lhs,
+        const std::vector<Basic_value<U>> &rhs,
+        const Basic_value<U> &bias
+    );
+    template <typename U>
+    friend Basic_value<U> tanh_dot(
+        const std::vector<Basic_value<U>> &lhs,
+        const std::vector<Basic_value<U>> &rhs,
+        const Basic_value<U> &bias
+    );
+    template <typename U>
+    friend std::vector<Basic_value<U>> apply_block(
+        std::shared_ptr<Basic_block<std::type_identity_t<U>>> block,
+        const std::vector<Basic_value<U>> &inputs,
+        size_t n_outputs
+    );
+    template <typename U>
+    friend Basic_value<U> log(const Basic_value<U> &arg);
+    template <typename U>
+    friend Basic_value<U> sigmoid(const Basic_value<U> &arg);
+    template <typename U>
+    friend Basic_value<U> gelu(const Basic_value<U> &arg);
+    template <typename U>
+    friend Basic_value<U> softplus(const Basic_value<U> &arg);
 
-    friend std::ostream &operator<<(std::ostream &os, const Value &value);
+    template <typename U>
+    friend std::ostream &operator<<(
+        std::ostream &os,
+        const Basic_value<U> &value
+    );
 
     friend Value;
+    friend Basic_topo_order<T>;
+    friend Basic_plan<T>;
 
 private:
-    double data_;
-    double grad_;
-    std::vector<Value> prev_;
-    std::function<void()> backward_;
-    std::string label_;
-
-    static void top_sort(
-        const Value &value,
-        std::unordered_set<Value> &visited,
-        std::vector<Value> &order
+    // State only some nodes have: the operands of n-ary ops, the block of a
+    // BLOCK hub and the label. Kept out of line, so that the common unary and
+    // binary nodes stay small.
+    struct Side;
+
+    T own_data_ = 0;
+    T own_grad_ = 0;
+    // The node's own fields, or slots of a Parameter_buffer.
+    T *data_ = &own_data_;
+    T *grad_ = &own_grad_;
+    std::array<Value, 2> prev_;
+    // Allocated from the same resource as the node, or from the heap when
+    // only a label is set.
+    Side *side_ = nullptr;
+    // Constant operand of the op: the exponent of POW, the addend of SHIFT,
+    // the factor of SCALE or the output index of BLOCK_OUTPUT. Kept in double
+    // for every T, so that output indices stay exact.
+    double param_ = 0;
+    // Epoch of the last topological sort that visited this node, or its slot
+    // in Topo_order::parked_ while a freeing backward keeps it alive.
+    uint64_t mark_ = 0;
+    Op op_ = Op::LEAF;
+    bool requires_grad_ = true;
+    bool parked_ = false;
+    // Whether backward has dropped the children.
+    bool freed_ = false;
+    // Whether the node was created while profiling.
+    bool profiled_ = false;
+
+    T &data() {
+        return *data_;
+    }
+    T &grad() {
+        return *grad_;
+    }
+    static Side *make_side(std::pmr::vector<Value> operands);
+    static std::pmr::memory_resource *resource();
+    template <typename... Args>
+    static Value allocate(Args &&...args);
+    static Value constant(T data);
+    static Value make_node(
+        Op op,
+        T data,
+        const Value &lhs,
+        const Value &rhs = nullptr,
+        double param = 0
+    );
+    static Value make_dot(
+        Op op,
+        const std::vector<Value> &lhs,
+        const std::vector<Value> &rhs,
+        const Value &bias
     );
+    std::span<const Value> children() const;
+    std::span<Value> operands();
+    void propagate();
+    void count();
+    void unlink(std::vector<Value> &worklist);
+    void release(std::vector<Value> &parked);
 };
 
 }  // namespace nn
@@ -0,0 +1,160 @@
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include "../src/checkpoint.hpp"
+#include "doctest.h"
+
+#include "../src/utils.hpp"
+
+using namespace nn;
+
+namespace {
+
+std::string temp_path(const std::string &name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+}  // namespace
+
+TEST_CASE("checkpoint_roundtrip") {
+    std::string path = temp_path("micropp_checkpoint_roundtrip.bin");
+    MLP mlp(3, {5, 4, 2}, Initializer(Init::XAVIER_NORMAL, 3));
+    std::vector<std::vector<Value>> X = {
+        {make_value(1), make_value(-1), make_value(0.5)},
+        {make_value(0), make_value(2), make_value(-0.5)}
+    };
+    std::vector<Value> y = {
+        make_value(1), make_value(0), make_value(-1), make_value(0.5)
+    };
+    Adam adam(mlp.buffer(), 0.01);
+    for (int it = 0; it < 3; ++it) {
+        adam.zero_grad();
+        backward(MSE_loss(y, flatten(mlp(X))));
+        adam.step();
+    }
+    Checkpoint::save(path, mlp, &adam);
+
+    Checkpoint checkpoint(path);
+    CHECK_EQ(checkpoint.in_size(), 3);
+    CHECK_EQ(checkpoint.out_sizes(), std::vector<size_t>{5, 4, 2});
+    CHECK_EQ(checkpoint.optimizer_steps(), 3);
+    std::span<const double> state = adam.state();
+    CHECK(std::equal(
+        state.begin(), state.end(), checkpoint.optimizer_state().begin(),
+        checkpoint.optimizer_state().end()
+    ));
+    // Sections are aligned for in-place use.
+    auto address = reinterpret_cast<uintptr_t>(checkpoint.parameters().data());
+    CHECK_EQ(address % 64, 0);
+
+    MLP mapped = checkpoint.mlp();
+    MLP copied = checkpoint.copy();
+    std::span<const double> expected = mlp.buffer().data();
+    CHECK_EQ(mapped.buffer().data().data(), checkpoint.parameters().data());
+    CHECK(std::equal(
+        expected.begin(), expected.end(), mapped.buffer().data().begin(),
+        mapped.buffer().data().end()
+    ));
+    CHECK(std::equal(
+        expected.begin(), expected.end(), copied.buffer().data().begin(),
+        copied.buffer().data().end()
+    ));
+
+    // Training resumes where it stopped.
+    Adam resumed(mapped.buffer(), 0.01);
+    checkpoint.restore(resumed);
+    for (MLP *model : {&mlp, &mapped}) {
+        model->zero_grad();
+        backward(MSE_loss(y, flatten((*model)(X))));
+    }
+    adam.step();
+    resumed.step();
+    CHECK(std::equal(
+        expected.begin(), expected.end(), mapped.buffer().data().begin(),
+        mapped.buffer().data().end()
+    ));
+    // Writes to a mapped model never reach the file.
+    CHECK_EQ(Checkpoint(path).optimizer_steps(), 3);
+
+    // The mapping outlives the Checkpoint through the parameters.
+    Value param;
+    {
+        Checkpoint scoped(path);
+        param = scoped.mlp().parameters()[0];
+    }
+    CHECK_EQ(param->get_data(), Checkpoint(path).parameters()[0]);
+
+    Checkpoint::save(path, mlp);
+    CHECK(Checkpoint(path).optimizer_state().empty());
+    CHECK_THROWS_AS(Checkpoint(path).restore(resumed), std::invalid_argument);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("checkpoint_errors") {
+    std::string path = temp_path("micropp_checkpoint_errors.bin");
+    CHECK_THROWS_AS(Checkpoint(path + ".missing"), std::runtime_error);
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << "not a checkpoint, just some text of a reasonable length "
+                "that is longer than the fixed header of the format";
+    }
+    CHECK_THROWS_AS(Checkpoint{path}, std::runtime_error);
+
+    Checkpoint::save(path, MLP(2, {3, 1}));
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+    CHECK_THROWS_AS(Checkpoint{path}, std::runtime_error);
+
+    // A layer count whose size in bytes wraps around to fit the file.
+    Checkpoint::save(path, MLP(2, {3, 1}));
+    {
+        std::fstream file(
+            path, std::ios::binary | std::ios::in | std::ios::out
+        );
+        uint64_t n_layers = uint64_t{1} << 61;
+        file.seekp(24);
+        file.write(reinterpret_cast<const char *>(&n_layers), sizeof(n_layers));
+    }
+    CHECK_THROWS_AS(Checkpoint{path}, std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("checkpoint_optimizer_mismatch") {
+    std::string path = temp_path("micropp_checkpoint_optimizer.bin");
+    MLP mlp(2, {3, 1});
+    SGD sgd(mlp.buffer(), 0.1, 0.9);
+    Checkpoint::save(path, mlp, &sgd);
+    Checkpoint checkpoint(path);
+    CHECK(checkpoint.optimizer_kind() == Optimizer_kind::SGD);
+
+    // Same state size as SGD with momentum, different update rule.
+    RMSProp rmsprop(mlp.buffer());
+    CHECK_THROWS_AS(checkpoint.restore(rmsprop), std::invalid_argument);
+    SGD other_momentum(mlp.buffer(), 0.1, 0.5);
+    CHECK_THROWS_AS(checkpoint.restore(other_momentum), std::invalid_argument);
+    // The learning rate may differ, as schedules change it.
+    SGD resumed(mlp.buffer(), 0.01, 0.9);
+    checkpoint.restore(resumed);
+    CHECK_EQ(resumed.steps(), sgd.steps());
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("checkpoint_overwrite_loaded") {
+    std::string path = temp_path("micropp_checkpoint_overwrite.bin");
+    MLP mlp(3, {64, 64, 2}, Initializer(Init::XAVIER_NORMAL, 3));
+    Checkpoint::save(path, mlp);
+    Checkpoint loaded(path);
+    std::span<const double> saved = mlp.buffer().data();
+    std::vector<double> expected(saved.begin(), saved.end());
+
+    // A smaller model over the same path: the old mapping must not be
+    // truncated or rewritten underneath the loaded checkpoint.
+    Checkpoint::save(path, MLP(2, {1}));
+    std::span<const double> params = loaded.parameters();
+    CHECK(std::equal(
+        expected.begin(), expected.end(), params.begin(), params.end()
+    ));
+    CHECK_EQ(Checkpoint(path).out_sizes(), std::vector<size_t>{1});
+    CHECK_FALSE(std::filesystem::exists(path + ".tmp"));
+    std::filesystem::remove(path);
+}
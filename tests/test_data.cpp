@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+#include "../src/data.hpp"
+#include "doctest.h"
+
+using namespace nn;
+
+namespace {
+
+std::string temp_path(const std::string &name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+}
+
+// Row i has features {i, -i} and target 2 * i.
+std::vector<double> make_X(size_t n) {
+    std::vector<double> res;
+    for (size_t it = 0; it < n; ++it) {
+        res.push_back(static_cast<double>(it));
+        res.push_back(-static_cast<double>(it));
+    }
+    return res;
+}
+
+std::vector<double> make_y(size_t n) {
+    std::vector<double> res;
+    for (size_t it = 0; it < n; ++it) {
+        res.push_back(2 * static_cast<double>(it));
+    }
+    return res;
+}
+
+// Ids of the rows of an epoch, checking that every row is consistent.
+std::vector<size_t> read_epoch(Data_loader &loader, size_t batch_size) {
+    std::vector<size_t> ids;
+    Batch batch;
+    while (loader.next(batch)) {
+        CHECK(batch.size <= batch_size);
+        CHECK_EQ(batch.X.size(), batch.size * 2);
+        CHECK_EQ(batch.y.size(), batch.size);
+        for (size_t it = 0; it < batch.size; ++it) {
+            CHECK_EQ(batch.X[it * 2 + 1], -batch.X[it * 2]);
+            CHECK_EQ(batch.y[it], 2 * batch.X[it * 2]);
+            ids.push_back(static_cast<size_t>(batch.X[it * 2]));
+        }
+    }
+    CHECK_EQ(batch.size, 0);
+    return ids;
+}
+
+std::vector<size_t> iota(size_t n) {
+    std::vector<size_t> res(n);
+    for (size_t it = 0; it < n; ++it) {
+        res[it] = it;
+    }
+    return res;
+}
+
+}  // namespace
+
+TEST_CASE("data_binary") {
+    std::string path = temp_path("micropp_data.bin");
+    size_t n = 103;
+    Binary_dataset::write(path, 2, 1, make_X(n), make_y(n));
+
+    Binary_dataset ordered(path, false);
+    CHECK_EQ(ordered.size(), n);
+    CHECK_EQ(ordered.n_features(), 2);
+    CHECK_EQ(ordered.n_targets(), 1);
+    Data_loader plain(ordered, 10);
+    CHECK_EQ(read_epoch(plain, 10), iota(n));
+    CHECK_EQ(plain.epoch(), 1);
+
+    Binary_dataset shuffled(path, true, 42);
+    Data_loader loader(shuffled, 16);
+    std::vector<size_t> first = read_epoch(loader, 16);
+    std::vector<size_t> second = read_epoch(loader, 16);
+    CHECK_NE(first, iota(n));
+    CHECK_NE(first, second);
+    std::sort(first.begin(), first.end());
+    std::sort(second.begin(), second.end());
+    CHECK_EQ(first, iota(n));
+    CHECK_EQ(second, iota(n));
+
+    // The order depends only on the seed and the epoch.
+    Binary_dataset again(path, true, 42);
+    Data_loader other(again, 7);
+    std::vector<size_t> replay = read_epoch(other, 7);
+    shuffled.reset(0);
+    std::vector<double> X(n * 2);
+    std::vector<double> y(n);
+    CHECK_EQ(shuffled.read(n + 5, X, y), n);
+    for (size_t it = 0; it < n; ++it) {
+        CHECK_EQ(static_cast<size_t>(X[it * 2]), replay[it]);
+    }
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("data_binary_errors") {
+    // A file of its own, as truncating a mapped file faults its readers.
+    std::string path = temp_path("micropp_data_errors.bin");
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << "garbage that is not a dataset header at all, long enough";
+    }
+    CHECK_THROWS_AS(Binary_dataset{path}, std::runtime_error);
+
+    // A row count whose size in bytes wraps around to the file's size.
+    Binary_dataset::write(path, 2, 1, make_X(8), make_y(8));
+    {
+        std::fstream file(
+            path, std::ios::binary | std::ios::in | std::ios::out
+        );
+        uint64_t n_rows = 8 + (uint64_t{1} << 61);
+        file.seekp(16);
+        file.write(reinterpret_cast<const char *>(&n_rows), sizeof(n_rows));
+    }
+    CHECK_THROWS_AS(Binary_dataset{path}, std::runtime_error);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("data_csv") {
+    std::string path = temp_path("micropp_data.csv");
+    size_t n = 50;
+    {
+        std::ofstream file(path);
+        file << "a,b,target\n";
+        for (size_t it = 0; it < n; ++it) {
+            double x = static_cast<double>(it);
+            file << x << ", " << -x << "," << 2 * x << "\r\n";
+            if (it == 20) {
+                file << "\n";
+            }
+        }
+    }
+
+    Csv_dataset ordered(path, 1, false);
+    CHECK_EQ(ordered.n_features(), 2);
+    Data_loader plain(ordered, 8);
+    CHECK_EQ(read_epoch(plain, 8), iota(n));
+    CHECK_EQ(read_epoch(plain, 8), iota(n));
+
+    // Shuffled within chunks of 16 rows.
+    Csv_dataset shuffled(path, 1, true, 7, 16);
+    Data_loader loader(shuffled, 5);
+    std::vector<size_t> ids = read_epoch(loader, 5);
+    CHECK_NE(ids, iota(n));
+    for (size_t it = 0; it < n; ++it) {
+        CHECK_EQ(ids[it] / 16, it / 16);
+    }
+    std::sort(ids.begin(), ids.end());
+    CHECK_EQ(ids, iota(n));
+
+    {
+        std::ofstream file(path, std::ios::app);
+        file << "1,2\n";
+    }
+    Csv_dataset broken(path, 1, false);
+    Data_loader failing(broken, 100);
+    Batch batch;
+    CHECK_THROWS_AS(failing.next(batch), std::runtime_error);
+    CHECK_THROWS_AS(Csv_dataset(path + ".missing"), std::runtime_error);
+    std::filesystem::remove(path);
+}
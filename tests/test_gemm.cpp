@@ -0,0 +1,115 @@
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include "../src/gemm.hpp"
+#include "doctest.h"
+
+using namespace nn;
+
+namespace {
+
+void naive_gemm(
+    bool trans_a,
+    bool trans_b,
+    size_t m,
+    size_t n,
+    size_t k,
+    double alpha,
+    const double *a,
+    size_t lda,
+    const double *b,
+    size_t ldb,
+    double beta,
+    double *c,
+    size_t ldc
+) {
+    for (size_t i = 0; i < m; ++i) {
+        for (size_t j = 0; j < n; ++j) {
+            double acc = 0;
+            for (size_t p = 0; p < k; ++p) {
+                double x = trans_a ? a[p * lda + i] : a[i * lda + p];
+                double y = trans_b ? b[j * ldb + p] : b[p * ldb + j];
+                acc += x * y;
+            }
+            c[i * ldc + j] = alpha * acc + beta * c[i * ldc + j];
+        }
+    }
+}
+
+std::vector<double> random_matrix(size_t size, std::mt19937 &gen) {
+    std::uniform_real_distribution<> dist(-1, 1);
+    std::vector<double> res(size);
+    for (double &val : res) {
+        val = dist(gen);
+    }
+    return res;
+}
+
+void check_against_naive(size_t m, size_t n, size_t k, std::mt19937 &gen) {
+    for (bool trans_a : {false, true}) {
+        for (bool trans_b : {false, true}) {
+            size_t lda = (trans_a ? m : k) + 1;
+            size_t ldb = (trans_b ? k : n) + 2;
+            size_t ldc = n + 3;
+            std::vector<double> a = random_matrix((trans_a ? k : m) * lda, gen);
+            std::vector<double> b = random_matrix((trans_b ? n : k) * ldb, gen);
+            std::vector<double> c = random_matrix(m * ldc, gen);
+            std::vector<double> expected = c;
+
+            naive_gemm(
+                trans_a, trans_b, m, n, k, 0.5, a.data(), lda, b.data(), ldb,
+                -2, expected.data(), ldc
+            );
+            gemm(
+                trans_a, trans_b, m, n, k, 0.5, a.data(), lda, b.data(), ldb,
+                -2, c.data(), ldc
+            );
+            double err = 0;
+            for (size_t it = 0; it < c.size(); ++it) {
+                err = std::max(err, std::abs(c[it] - expected[it]));
+            }
+            CHECK(err < 1e-10);
+        }
+    }
+}
+
+}  // namespace
+
+TEST_CASE("gemm_matches_naive") {
+    std::mt19937 gen(42);
+    Gemm_isa initial = gemm_isa();
+    for (Gemm_isa isa : {Gemm_isa::SCALAR, Gemm_isa::AVX2, Gemm_isa::AVX512}) {
+        if (!gemm_isa_supported(isa)) {
+            continue;
+        }
+        set_gemm_isa(isa);
+        check_against_naive(1, 1, 1, gen);
+        check_against_naive(3, 5, 7, gen);
+        check_against_naive(4, 16, 8, gen);
+        check_against_naive(33, 17, 65, gen);
+        // Crosses the MC and KC block boundaries.
+        check_against_naive(130, 21, 300, gen);
+    }
+    set_gemm_isa(initial);
+}
+
+TEST_CASE("gemm_beta_zero") {
+    // beta = 0 must overwrite C even if it holds NaN.
+    std::vector<double> a = {1, 2, 3, 4};
+    std::vector<double> b = {5, 6, 7, 8};
+    std::vector<double> c(4, std::nan(""));
+    gemm(false, false, 2, 2, 2, 1, a.data(), 2, b.data(), 2, 0, c.data(), 2);
+    CHECK_EQ(c, std::vector<double>{19, 22, 43, 50});
+
+    gemm(false, false, 2, 2, 0, 1, a.data(), 2, b.data(), 2, 0, c.data(), 2);
+    CHECK_EQ(c, std::vector<double>{0, 0, 0, 0});
+}
+
+TEST_CASE("gemm_isa_selection") {
+    CHECK(gemm_isa_supported(Gemm_isa::SCALAR));
+    CHECK(gemm_isa_supported(gemm_isa()));
+    if (!gemm_isa_supported(Gemm_isa::AVX512)) {
+        CHECK_THROWS_AS(set_gemm_isa(Gemm_isa::AVX512), std::invalid_argument);
+    }
+}
@@ -0,0 +1,99 @@
+#include <cmath>
+#include <vector>
+#include "../src/init.hpp"
+#include "doctest.h"
+
+#include "../src/mlp.hpp"
+#include "../src/parallel.hpp"
+
+using namespace nn;
+
+namespace {
+
+std::vector<double> data(const MLP &mlp) {
+    std::vector<double> res;
+    for (const Value &param : mlp.parameters()) {
+        res.push_back(param->get_data());
+    }
+    return res;
+}
+
+}  // namespace
+
+TEST_CASE("philox_known_answers") {
+    // Known-answer vectors of the Random123 reference implementation.
+    CHECK_EQ(
+        Philox::round10({0, 0, 0, 0}, {0, 0}),
+        Philox::Block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}
+    );
+    CHECK_EQ(
+        Philox::round10(
+            {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+            {0xffffffff, 0xffffffff}
+        ),
+        Philox::Block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}
+    );
+    CHECK_EQ(
+        Philox::round10(
+            {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344},
+            {0xa4093822, 0x299f31d0}
+        ),
+        Philox::Block{0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}
+    );
+    CHECK_EQ(Philox(0, 0)(0), Philox::round10({0, 0, 0, 0}, {0, 0}));
+}
+
+TEST_CASE("random_uniform_range") {
+    for (int it = 0; it < 1000; ++it) {
+        double u = random_uniform();
+        CHECK(u >= 0);
+        CHECK(u < 1);
+    }
+}
+
+TEST_CASE("initializer_schemes") {
+    const size_t n = 20000;
+    std::vector<double> values(n);
+
+    Initializer xavier(Init::XAVIER_UNIFORM, 7);
+    xavier.fill(values, 100, 50, 0);
+    double bound = std::sqrt(6.0 / 150);
+    for (double val : values) {
+        CHECK(std::abs(val) <= bound);
+    }
+
+    Initializer he(Init::HE_NORMAL, 7);
+    he.fill(values, 100, 50, 0);
+    double mean = 0;
+    double var = 0;
+    for (double val : values) {
+        mean += val / n;
+    }
+    for (double val : values) {
+        var += (val - mean) * (val - mean) / n;
+    }
+    CHECK(std::abs(mean) < 0.01);
+    CHECK(std::abs(var - 2.0 / 100) < 0.002);
+}
+
+TEST_CASE("initializer_reproducible") {
+    std::vector<double> serial(1000);
+    std::vector<double> parallel(1000);
+    Initializer init(Init::NORMAL, 123);
+    init.fill(serial, 10, 10, 3);
+    Thread_pool pool(4);
+    init.fill(parallel, 10, 10, 3, &pool);
+    CHECK_EQ(serial, parallel);
+    CHECK_EQ(serial[17], init(10, 10, 3, 17));
+
+    MLP lhs(3, {8, 4, 1}, Initializer(Init::XAVIER_UNIFORM, 5));
+    MLP rhs(3, {8, 4, 1}, Initializer(Init::XAVIER_UNIFORM, 5), &pool);
+    MLP other(3, {8, 4, 1}, Initializer(Init::XAVIER_UNIFORM, 6));
+    CHECK_EQ(data(lhs), data(rhs));
+    CHECK_NE(data(lhs), data(other));
+
+    // Biases start at zero.
+    std::vector<double> params = data(lhs);
+    CHECK_EQ(params[3], 0);
+    CHECK_EQ(params[7], 0);
+}
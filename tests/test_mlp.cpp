@@ -0,0 +1,436 @@
+#include <cmath>
+#include <span>
+#include <type_traits>
+#include "../src/mlp.hpp"
+#include "doctest.h"
+
+#include "../src/alloc_counter.hpp"
+#include "../src/parallel.hpp"
+#include "../src/profile.hpp"
+#include "../src/utils.hpp"
+
+using namespace nn;
+
+#define CHECK_EQ_F(a, b) CHECK(std::abs((a) - (b)) < 1e-9)
+
+namespace {
+
+std::vector<std::vector<Value>> make_batch() {
+    return {
+        {make_value(2.0), make_value(3.0), make_value(-1.0)},
+        {make_value(3.0), make_value(-1.0), make_value(0.5)},
+        {make_value(0.5), make_value(1.0), make_value(1.0)},
+        {make_value(1.0), make_value(1.0), make_value(-1.0)}
+    };
+}
+
+std::vector<Value> make_targets() {
+    return {make_value(1), make_value(-1), make_value(-1), make_value(1)};
+}
+
+}  // namespace
+
+TEST_CASE("mlp_parameters") {
+    MLP mlp(3, {4, 2});
+    CHECK_EQ(mlp.parameters().size(), 4 * (3 + 1) + 2 * (4 + 1));
+}
+
+TEST_CASE("mlp_batched_forward") {
+    MLP mlp(3, {4, 4, 2});
+    std::vector<std::vector<Value>> X = make_batch();
+
+    std::vector<std::vector<Value>> batched = mlp(X);
+    REQUIRE_EQ(batched.size(), X.size());
+    for (size_t s = 0; s < X.size(); ++s) {
+        std::vector<Value> single = mlp(X[s]);
+        REQUIRE_EQ(batched[s].size(), 2);
+        CHECK_EQ_F(batched[s][0]->get_data(), single[0]->get_data());
+        CHECK_EQ_F(batched[s][1]->get_data(), single[1]->get_data());
+    }
+
+    std::vector<std::vector<Value>> short_sample = {{make_value(1)}};
+    CHECK_THROWS_AS(mlp(short_sample), std::invalid_argument);
+}
+
+TEST_CASE("mlp_batched_grad") {
+    MLP mlp(3, {4, 4, 1});
+    std::vector<std::vector<Value>> X = make_batch();
+    std::vector<Value> y = make_targets();
+    std::vector<Value> params = mlp.parameters();
+
+    backward(MSE_loss(y, flatten(mlp(X))));
+    std::vector<double> batched;
+    for (const Value &param : params) {
+        batched.push_back(param->get_grad());
+    }
+    std::vector<double> inputs;
+    for (const Value &val : X[1]) {
+        inputs.push_back(val->get_grad());
+        val->zero_grad();
+    }
+
+    mlp.zero_grad();
+    std::vector<Value> y_pred;
+    for (const auto &sample : X) {
+        y_pred.push_back(mlp(sample)[0]);
+    }
+    backward(MSE_loss(y, y_pred));
+    for (size_t it = 0; it < params.size(); ++it) {
+        CHECK_EQ_F(params[it]->get_grad(), batched[it]);
+    }
+    for (size_t it = 0; it < X[1].size(); ++it) {
+        CHECK_EQ_F(X[1][it]->get_grad(), inputs[it]);
+    }
+}
+
+TEST_CASE("mlp_batched_retained_grad") {
+    MLP mlp(3, {4, 4, 1});
+    std::vector<std::vector<Value>> X = make_batch();
+    std::vector<Value> y = make_targets();
+    Value loss = MSE_loss(y, flatten(mlp(X)));
+
+    backward(loss, true);
+    std::vector<double> once(
+        mlp.buffer().grad().begin(), mlp.buffer().grad().end()
+    );
+    double input_once = X[1][0]->get_grad();
+    // The block's Tensor graph is replayed, not accumulated into.
+    backward(loss, true);
+    for (size_t it = 0; it < once.size(); ++it) {
+        CHECK_EQ_F(mlp.buffer().grad()[it], 2 * once[it]);
+    }
+    CHECK_EQ_F(X[1][0]->get_grad(), 2 * input_once);
+}
+
+TEST_CASE("mlp_retain_graph") {
+    // Both block paths: the batched Tensor block and checkpointed layers.
+    for (bool checkpointing : {false, true}) {
+        MLP mlp(3, {4, 4, 1});
+        mlp.set_checkpointing(checkpointing);
+        std::vector<std::vector<Value>> X = make_batch();
+        std::vector<Value> y = make_targets();
+        std::vector<Value> y_pred;
+        if (checkpointing) {
+            for (const auto &sample : X) {
+                y_pred.push_back(mlp(sample)[0]);
+            }
+        } else {
+            y_pred = flatten(mlp(X));
+        }
+        Value loss = MSE_loss(y, y_pred);
+
+        backward(loss, true);
+        std::vector<double> once(
+            mlp.buffer().grad().begin(), mlp.buffer().grad().end()
+        );
+        double input_once = X[2][1]->get_grad();
+        // Every pass adds exactly one gradient, the last one freeing.
+        backward(loss, true);
+        backward(loss);
+        for (size_t it = 0; it < once.size(); ++it) {
+            CHECK_EQ_F(mlp.buffer().grad()[it], 3 * once[it]);
+        }
+        CHECK_EQ_F(X[2][1]->get_grad(), 3 * input_once);
+        CHECK_THROWS_AS(backward(loss), std::logic_error);
+    }
+}
+
+TEST_CASE("mlp_parameter_buffer") {
+    MLP mlp(3, {4, 1});
+    std::vector<Value> params = mlp.parameters();
+    std::span<double> data = mlp.buffer().data();
+    std::span<double> grad = mlp.buffer().grad();
+    REQUIRE_EQ(data.size(), params.size());
+    for (size_t it = 0; it < params.size(); ++it) {
+        CHECK_EQ(params[it], mlp.buffer()[it]);
+        params[it]->set_grad(static_cast<double>(it));
+        CHECK_EQ(grad[it], static_cast<double>(it));
+    }
+
+    std::vector<double> before(data.begin(), data.end());
+    Thread_pool pool(4);
+    mlp.update(0.1, &pool);
+    for (size_t it = 0; it < params.size(); ++it) {
+        CHECK_EQ(
+            params[it]->get_data(), before[it] - 0.1 * static_cast<double>(it)
+        );
+    }
+    mlp.zero_grad();
+    for (const Value &param : params) {
+        CHECK_EQ(param->get_grad(), 0);
+    }
+}
+
+TEST_CASE("mlp_predict") {
+    MLP mlp(3, {4, 4, 2});
+    std::vector<std::vector<Value>> X = make_batch();
+    std::vector<double> input;
+    for (const auto &sample : X) {
+        for (const Value &val : sample) {
+            input.push_back(val->get_data());
+        }
+    }
+
+    std::vector<double> output(2);
+    std::vector<double> batched(X.size() * 2);
+    mlp.predict(input, X.size(), batched);
+    for (size_t it = 0; it < X.size(); ++it) {
+        std::vector<Value> expected = mlp(X[it]);
+        mlp.predict(std::span(input).subspan(it * 3, 3), output);
+        for (size_t j = 0; j < 2; ++j) {
+            CHECK_EQ_F(output[j], expected[j]->get_data());
+            CHECK_EQ_F(batched[it * 2 + j], expected[j]->get_data());
+        }
+    }
+
+    uint64_t before = heap_allocations();
+    for (int it = 0; it < 10; ++it) {
+        mlp.predict(std::span(input).first(3), output);
+        mlp.predict(input, X.size(), batched);
+    }
+    CHECK_EQ(heap_allocations() - before, 0);
+
+    CHECK_THROWS_AS(mlp.predict(input, output), std::invalid_argument);
+}
+
+TEST_CASE("mlp_compile") {
+    MLP mlp(3, {4, 4, 1});
+    std::vector<std::vector<Value>> X = make_batch();
+    std::vector<Value> y = make_targets();
+
+    // Plan of the whole loss over the minibatch.
+    std::vector<Value> inputs;
+    std::vector<std::vector<Value>> X_in;
+    std::vector<Value> y_in;
+    for (size_t it = 0; it < X.size(); ++it) {
+        X_in.emplace_back();
+        for (size_t j = 0; j < 3; ++j) {
+            X_in.back().push_back(make_value(0.0));
+            inputs.push_back(X_in.back().back());
+        }
+    }
+    for (size_t it = 0; it < y.size(); ++it) {
+        y_in.push_back(make_value(0.0));
+        inputs.push_back(y_in.back());
+    }
+    std::vector<Value> y_pred;
+    for (const auto &sample : X_in) {
+        y_pred.push_back(mlp(sample)[0]);
+    }
+    Plan plan(inputs, {MSE_loss(y_in, y_pred)});
+
+    std::vector<double> input;
+    for (const auto &sample : X) {
+        for (const Value &val : sample) {
+            input.push_back(val->get_data());
+        }
+    }
+    for (const Value &val : y) {
+        input.push_back(val->get_data());
+    }
+
+    Plan sample_plan = mlp.compile();
+    // Replays the fused minibatch block.
+    Plan batch_plan(
+        std::vector<Value>(inputs.begin(), inputs.begin() + 12),
+        flatten(mlp(X_in))
+    );
+    std::vector<double> output(1);
+    std::vector<double> batch_output(X.size());
+    for (int step = 0; step < 3; ++step) {
+        mlp.zero_grad();
+        Value loss = MSE_loss(y, flatten(mlp(X)));
+        backward(loss);
+        std::vector<double> expected(
+            mlp.buffer().grad().begin(), mlp.buffer().grad().end()
+        );
+
+        mlp.zero_grad();
+        plan.forward(input);
+        plan.backward(std::vector<double>{1});
+        CHECK_EQ_F(plan.output()[0], loss->get_data());
+        for (size_t it = 0; it < expected.size(); ++it) {
+            CHECK_EQ_F(mlp.buffer().grad()[it], expected[it]);
+        }
+
+        sample_plan.forward(std::span(input).first(3));
+        mlp.predict(std::span(input).first(3), output);
+        CHECK_EQ_F(sample_plan.output()[0], output[0]);
+
+        batch_plan.forward(std::span(input).first(12));
+        mlp.predict(std::span(input).first(12), X.size(), batch_output);
+        for (size_t it = 0; it < X.size(); ++it) {
+            CHECK_EQ_F(batch_plan.output()[it], batch_output[it]);
+        }
+        mlp.update(0.1);
+    }
+}
+
+TEST_CASE("mlp_compile_keeps_graph") {
+    MLP mlp(3, {4, 4, 1});
+    std::vector<std::vector<Value>> X = make_batch();
+    std::vector<Value> y = make_targets();
+    mlp.zero_grad();
+    backward(MSE_loss(y, flatten(mlp(X))));
+    std::vector<double> expected(
+        mlp.buffer().grad().begin(), mlp.buffer().grad().end()
+    );
+
+    // Replaying a plan of the batched graph with other inputs must not touch
+    // the forward state the graph's own block backpropagates from.
+    Value loss = MSE_loss(y, flatten(mlp(X)));
+    std::vector<Value> inputs;
+    std::vector<double> other;
+    for (const auto &sample : X) {
+        for (const Value &val : sample) {
+            inputs.push_back(val);
+            other.push_back(-2 * val->get_data());
+        }
+    }
+    Plan plan(inputs, {loss});
+    plan.forward(other);
+    plan.backward(std::vector<double>{1});
+
+    mlp.zero_grad();
+    backward(loss);
+    for (size_t it = 0; it < expected.size(); ++it) {
+        CHECK_EQ_F(mlp.buffer().grad()[it], expected[it]);
+    }
+}
+
+TEST_CASE("mlp_checkpointing") {
+    MLP mlp(3, {4, 4, 2});
+    std::vector<std::vector<Value>> X = make_batch();
+    std::vector<Value> y = make_targets();
+    auto loss = [&]() {
+        std::vector<Value> y_pred;
+        for (const auto &sample : X) {
+            std::vector<Value> out = mlp(sample);
+            y_pred.push_back(out[0] * out[1]);
+        }
+        return MSE_loss(y, y_pred);
+    };
+
+    Value plain = loss();
+    backward(plain);
+    std::vector<double> expected(
+        mlp.buffer().grad().begin(), mlp.buffer().grad().end()
+    );
+    std::vector<double> inputs;
+    for (const Value &val : X[2]) {
+        inputs.push_back(val->get_grad());
+        val->zero_grad();
+    }
+
+    mlp.zero_grad();
+    mlp.set_checkpointing(true);
+    CHECK(mlp.replica().checkpointing());
+    Value checkpointed = loss();
+    backward(checkpointed);
+    CHECK_EQ_F(checkpointed->get_data(), plain->get_data());
+    for (size_t it = 0; it < expected.size(); ++it) {
+        CHECK_EQ_F(mlp.buffer().grad()[it], expected[it]);
+    }
+    for (size_t it = 0; it < X[2].size(); ++it) {
+        CHECK_EQ_F(X[2][it]->get_grad(), inputs[it]);
+    }
+
+    // Constant inputs still train the parameters, and a Plan replays it.
+    mlp.zero_grad();
+    std::vector<Value> in = {make_constant(2.0), make_constant(3.0), X[0][2]};
+    backward(mlp(in)[1]);
+    std::vector<double> grad(
+        mlp.buffer().grad().begin(), mlp.buffer().grad().end()
+    );
+    CHECK_NE(grad[0], 0);
+    mlp.zero_grad();
+    Plan plan = mlp.compile();
+    plan.forward(std::vector<double>{2.0, 3.0, -1.0});
+    plan.backward(std::vector<double>{0, 1});
+    for (size_t it = 0; it < grad.size(); ++it) {
+        CHECK_EQ_F(mlp.buffer().grad()[it], grad[it]);
+    }
+}
+
+TEST_CASE("mlp_checkpointing_memory") {
+    MLP mlp(16, {32, 32, 1});
+    std::vector<Value> input;
+    for (size_t it = 0; it < 16; ++it) {
+        input.push_back(make_constant(0.1 * static_cast<double>(it)));
+    }
+    auto graph_bytes = [&]() {
+        set_profiling(true);
+        reset_profile();
+        Value out = mlp(input)[0];
+        uint64_t res = profile().bytes;
+        set_profiling(false);
+        return res;
+    };
+    uint64_t plain = graph_bytes();
+    mlp.set_checkpointing(true);
+    uint64_t checkpointed = graph_bytes();
+    CHECK_LT(4 * checkpointed, plain);
+}
+
+namespace {
+
+// Tolerance of the tests run for both scalar types.
+template <typename T>
+constexpr double TOLERANCE = std::is_same_v<T, float> ? 1e-4 : 1e-9;
+
+}  // namespace
+
+TEST_CASE_TEMPLATE("mlp_scalar_types", T, float, double) {
+    using Sample = std::vector<Basic_value<T>>;
+    Initializer init(Init::XAVIER_UNIFORM, 7);
+    Basic_MLP<T> mlp(3, {4, 4, 1}, init);
+    MLP ref(3, {4, 4, 1}, init);
+    std::vector<std::vector<Value>> ref_X = make_batch();
+    std::vector<Value> ref_y = make_targets();
+    std::vector<Sample> X;
+    Sample y;
+    std::vector<T> input;
+    for (size_t s = 0; s < ref_X.size(); ++s) {
+        X.emplace_back();
+        for (const Value &val : ref_X[s]) {
+            X.back().push_back(make_constant<T>(val->get_data()));
+            input.push_back(static_cast<T>(val->get_data()));
+        }
+        y.push_back(make_constant<T>(ref_y[s]->get_data()));
+    }
+    auto close = [](double lhs, double rhs) {
+        return std::abs(lhs - rhs) < TOLERANCE<T>;
+    };
+
+    backward(MSE_loss(y, flatten(mlp(X))));
+    backward(MSE_loss(ref_y, flatten(ref(ref_X))));
+    std::span<const T> grad = mlp.buffer().grad();
+    std::span<const double> ref_grad = ref.buffer().grad();
+    for (size_t it = 0; it < grad.size(); ++it) {
+        CHECK(close(mlp.buffer().data()[it], ref.buffer().data()[it]));
+        CHECK(close(grad[it], ref_grad[it]));
+    }
+
+    std::vector<T> batch_output(X.size());
+    mlp.predict(input, X.size(), batch_output);
+    Basic_plan<T> plan = mlp.compile();
+    mlp.set_checkpointing(true);
+    for (size_t s = 0; s < X.size(); ++s) {
+        T expected = ref(ref_X[s])[0]->get_data();
+        std::span<const T> sample = std::span(input).subspan(3 * s, 3);
+        plan.forward(sample);
+        CHECK(close(mlp(X[s])[0]->get_data(), expected));
+        CHECK(close(plan.output()[0], expected));
+        CHECK(close(batch_output[s], expected));
+    }
+
+    mlp.zero_grad();
+    Basic_value<T> loss = MSE_loss(y, flatten(mlp(X)));
+    T before = loss->get_data();
+    backward(loss);
+    for (size_t it = 0; it < grad.size(); ++it) {
+        CHECK(close(grad[it], ref_grad[it]));
+    }
+    mlp.update(0.1);
+    CHECK_LT(MSE_loss(y, flatten(mlp(X)))->get_data(), before);
+}
@@ -0,0 +1,142 @@
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "../src/optim.hpp"
+#include "doctest.h"
+
+#include "../src/mlp.hpp"
+#include "../src/parallel.hpp"
+#include "../src/utils.hpp"
+
+using namespace nn;
+
+#define CHECK_EQ_F(a, b) CHECK(std::abs((a) - (b)) < 1e-9)
+
+namespace {
+
+// Sets the gradient of sum((w - target)^2 / 2), i.e. w - target.
+void quadratic_grad(
+    Parameter_buffer &params,
+    const std::vector<double> &target
+) {
+    for (size_t it = 0; it < params.size(); ++it) {
+        params.grad()[it] = params.data()[it] - target[it];
+    }
+}
+
+}  // namespace
+
+TEST_CASE("optim_sgd") {
+    std::vector<double> init = {1, -2};
+    Parameter_buffer params(init);
+    SGD sgd(params, 0.1, 0.9);
+    CHECK_EQ(sgd.state().size(), 2);
+
+    params.grad()[0] = 1;
+    params.grad()[1] = -1;
+    sgd.step();
+    CHECK_EQ_F(params.data()[0], 1 - 0.1);
+    CHECK_EQ_F(params.data()[1], -2 + 0.1);
+    sgd.step();
+    // v = 0.9 * 1 + 1
+    CHECK_EQ_F(params.data()[0], 0.9 - 0.1 * 1.9);
+    CHECK_EQ(sgd.steps(), 2);
+
+    sgd.zero_grad();
+    CHECK_EQ(params[0]->get_grad(), 0);
+
+    SGD plain(params, 0.5);
+    CHECK(plain.state().empty());
+    params.grad()[1] = 2;
+    plain.step();
+    CHECK_EQ_F(params.data()[1], -1.9 + 0.1 * 1.9 - 0.5 * 2);
+}
+
+TEST_CASE("optim_adam") {
+    std::vector<double> init = {1, 1};
+    Parameter_buffer params(init);
+    Adam adam(params, 0.01);
+    CHECK_EQ(adam.state().size(), 4);
+
+    // The first bias-corrected step has size lr whatever the gradient scale.
+    params.grad()[0] = 100;
+    params.grad()[1] = -0.001;
+    adam.step();
+    CHECK(std::abs(params.data()[0] - 0.99) < 1e-6);
+    CHECK(std::abs(params.data()[1] - 1.01) < 1e-4);
+    CHECK_EQ_F(adam.state()[0], 10);
+    CHECK_EQ_F(adam.state()[2], 0.001 * 100 * 100);
+
+    std::vector<double> zeros = {1, 1};
+    Parameter_buffer decayed(zeros);
+    AdamW adamw(decayed, 0.01, 0.9, 0.999, 1e-8, 0.5);
+    adamw.step();
+    // Zero gradients: only the decoupled decay applies.
+    CHECK_EQ_F(decayed.data()[0], 1 - 0.01 * 0.5);
+}
+
+TEST_CASE("optim_rmsprop") {
+    std::vector<double> init = {0};
+    Parameter_buffer params(init);
+    RMSProp rmsprop(params, 0.01, 0.99, 0);
+    params.grad()[0] = 2;
+    rmsprop.step();
+    CHECK_EQ_F(rmsprop.state()[0], 0.01 * 4);
+    CHECK_EQ_F(params.data()[0], -0.01 * 2 / std::sqrt(0.04));
+}
+
+TEST_CASE("optim_converges") {
+    std::vector<double> target = {3, -1, 0.5, 2};
+    std::vector<double> init(target.size(), 0);
+    Thread_pool pool(3);
+    for (int kind = 0; kind < 4; ++kind) {
+        Parameter_buffer params(init);
+        Parameter_buffer pooled(init);
+        auto make = [kind](Parameter_buffer buf) -> std::unique_ptr<Optimizer> {
+            switch (kind) {
+                case 0:
+                    return std::make_unique<SGD>(buf, 0.1, 0.9);
+                case 1:
+                    return std::make_unique<Adam>(buf, 0.1);
+                case 2:
+                    return std::make_unique<AdamW>(
+                        buf, 0.1, 0.9, 0.999, 1e-8, 0
+                    );
+                default:
+                    return std::make_unique<RMSProp>(buf, 0.01);
+            }
+        };
+        std::unique_ptr<Optimizer> serial = make(params);
+        std::unique_ptr<Optimizer> parallel = make(pooled);
+        for (int it = 0; it < 500; ++it) {
+            quadratic_grad(params, target);
+            quadratic_grad(pooled, target);
+            serial->step();
+            parallel->step(&pool);
+        }
+        for (size_t it = 0; it < target.size(); ++it) {
+            CHECK(std::abs(params.data()[it] - target[it]) < 0.05);
+            CHECK_EQ(params.data()[it], pooled.data()[it]);
+        }
+    }
+}
+
+TEST_CASE("optim_mlp") {
+    MLP mlp(2, {8, 1}, Initializer(Init::XAVIER_UNIFORM, 1));
+    std::vector<std::vector<Value>> X = {
+        {make_value(0), make_value(1)}, {make_value(1), make_value(0)}
+    };
+    std::vector<Value> y = {make_value(0.5), make_value(-0.5)};
+    Adam adam(mlp.buffer(), 0.05);
+    double first = 0;
+    double last = 0;
+    for (int it = 0; it < 100; ++it) {
+        Tape tape;
+        Value loss = MSE_loss(y, flatten(mlp(X)));
+        adam.zero_grad();
+        backward(loss);
+        adam.step();
+        (it == 0 ? first : last) = loss->get_data();
+    }
+    CHECK(last < first * 0.01);
+}
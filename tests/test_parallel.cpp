@@ -0,0 +1,93 @@
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include "../src/parallel.hpp"
+#include "doctest.h"
+
+#include "../src/utils.hpp"
+
+using namespace nn;
+
+namespace {
+
+std::vector<std::vector<Value>> make_batch(size_t n) {
+    std::vector<std::vector<Value>> res;
+    for (size_t it = 0; it < n; ++it) {
+        double x = static_cast<double>(it);
+        res.push_back({make_value(std::sin(x)), make_value(std::cos(x))});
+    }
+    return res;
+}
+
+std::vector<Value> make_targets(size_t n) {
+    std::vector<Value> res;
+    for (size_t it = 0; it < n; ++it) {
+        res.push_back(make_value(it % 2 == 0 ? 1 : -1));
+    }
+    return res;
+}
+
+std::vector<double> grads(const MLP &mlp) {
+    std::vector<double> res;
+    for (const Value &param : mlp.parameters()) {
+        res.push_back(param->get_grad());
+    }
+    return res;
+}
+
+}  // namespace
+
+TEST_CASE("thread_pool_run") {
+    for (size_t n_threads : {1, 4}) {
+        Thread_pool pool(n_threads);
+        CHECK_EQ(pool.size(), n_threads);
+
+        std::vector<std::atomic<int>> hits(100);
+        for (int round = 0; round < 3; ++round) {
+            pool.run(hits.size(), [&hits](size_t it) { ++hits[it]; });
+        }
+        for (const auto &hit : hits) {
+            CHECK_EQ(hit.load(), 3);
+        }
+
+        CHECK_THROWS_AS(
+            pool.run(
+                8,
+                [](size_t it) {
+                    if (it == 5) {
+                        throw std::runtime_error("task failed");
+                    }
+                }
+            ),
+            std::runtime_error
+        );
+        pool.run(0, [](size_t) {});
+    }
+}
+
+TEST_CASE("data_parallel_matches_serial") {
+    MLP mlp(2, {5, 3, 1});
+    std::vector<std::vector<Value>> X = make_batch(11);
+    std::vector<Value> y = make_targets(11);
+
+    Value loss = MSE_loss(y, flatten(mlp(X)));
+    backward(loss);
+    std::vector<double> expected = grads(mlp);
+
+    for (size_t n_threads : {1, 3, 4, 16}) {
+        Thread_pool pool(n_threads);
+        Data_parallel trainer(mlp, pool);
+
+        mlp.zero_grad();
+        CHECK(std::abs(trainer.step(X, y) - loss->get_data()) < 1e-12);
+        std::vector<double> first = grads(mlp);
+        for (size_t it = 0; it < expected.size(); ++it) {
+            CHECK(std::abs(first[it] - expected[it]) < 1e-12);
+        }
+
+        // Bitwise reproducible for a fixed thread count.
+        mlp.zero_grad();
+        trainer.step(X, y);
+        CHECK_EQ(grads(mlp), first);
+    }
+}
@@ -0,0 +1,86 @@
+#include <sstream>
+#include <string>
+#include "../src/profile.hpp"
+#include "doctest.h"
+
+#include "../src/value.hpp"
+
+using namespace nn;
+
+TEST_CASE("profile_disabled") {
+    set_profiling(false);
+    reset_profile();
+    Value a = make_value(2.0);
+    Value b = tanh(a * a + 1.0);
+    backward(b);
+    Profile res = profile();
+    CHECK_EQ(res.total_nodes(), 0);
+    CHECK_EQ(res.bytes, 0);
+    CHECK_EQ(res.calls[static_cast<size_t>(Phase::BACKWARD)], 0);
+}
+
+TEST_CASE("profile_nodes") {
+    set_profiling(true);
+    reset_profile();
+    uint64_t live = profile().live_nodes;
+    {
+        Value a = make_value(2.0);
+        Value b = make_value(3.0);
+        Value c = tanh(a * b + 1.0) - a;
+        {
+            Profile_scope build(Phase::BUILD);
+        }
+        backward(c);
+
+        Profile res = profile();
+        CHECK_EQ(res.nodes[static_cast<size_t>(Op::LEAF)], 2);
+        CHECK_EQ(res.nodes[static_cast<size_t>(Op::MUL)], 1);
+        CHECK_EQ(res.nodes[static_cast<size_t>(Op::SHIFT)], 1);
+        CHECK_EQ(res.nodes[static_cast<size_t>(Op::TANH)], 1);
+        CHECK_EQ(res.nodes[static_cast<size_t>(Op::SUB)], 1);
+        CHECK_EQ(res.total_nodes(), 6);
+        CHECK_GE(res.bytes, 6 * sizeof(Value_handler));
+        // backward freed the mul, shift and tanh nodes.
+        CHECK_EQ(res.live_nodes, live + 3);
+        CHECK_EQ(res.peak_live_nodes, live + 6);
+        for (size_t it = 0; it < N_PHASES; ++it) {
+            CHECK_EQ(res.calls[it], 1);
+        }
+    }
+    Profile res = profile();
+    CHECK_EQ(res.live_nodes, live);
+    CHECK_EQ(res.peak_live_nodes, live + 6);
+
+    reset_profile();
+    res = profile();
+    CHECK_EQ(res.total_nodes(), 0);
+    CHECK_EQ(res.peak_live_nodes, live);
+    set_profiling(false);
+}
+
+TEST_CASE("profile_created_before_enabling") {
+    set_profiling(false);
+    Value a = make_value(1.0);
+    set_profiling(true);
+    reset_profile();
+    uint64_t live = profile().live_nodes;
+    a = nullptr;
+    CHECK_EQ(profile().live_nodes, live);
+    set_profiling(false);
+}
+
+TEST_CASE("profile_print") {
+    set_profiling(true);
+    reset_profile();
+    Value a = make_value(2.0);
+    Value b = exp(a);
+    backward(b);
+    set_profiling(false);
+
+    std::ostringstream os;
+    os << profile();
+    std::string text = os.str();
+    CHECK_NE(text.find("nodes 2"), std::string::npos);
+    CHECK_NE(text.find("exp"), std::string::npos);
+    CHECK_NE(text.find("backward"), std::string::npos);
+}
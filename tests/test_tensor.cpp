@@ -0,0 +1,142 @@
+#include <cmath>
+#include "../src/tensor.hpp"
+#include "doctest.h"
+
+#include "../src/mlp.hpp"
+#include "../src/utils.hpp"
+
+using namespace nn;
+
+#define CHECK_EQ_F(a, b) CHECK(std::abs((a) - (b)) < 1e-9)
+
+TEST_CASE("tensor_basic") {
+    Tensor a = make_tensor({2, 3}, {1, 2, 3, 4, 5, 6});
+
+    CHECK_EQ(a->size(), 6);
+    CHECK_EQ(a->shape(), Shape{2, 3});
+    CHECK_EQ(a->strides(), Shape{3, 1});
+    CHECK_EQ(a->data()[4], 5);
+    CHECK(a->grad().empty());
+
+    CHECK_THROWS_AS(make_tensor({2, 2}, {1, 2, 3}), std::invalid_argument);
+}
+
+TEST_CASE("tensor_elementwise") {
+    Tensor a = make_tensor({2, 2}, {1, 2, 3, 4});
+    Tensor b = make_tensor({2, 2}, {5, 6, 7, 8});
+
+    Tensor c = a * b - a + b * 2.0;
+    CHECK_EQ(c->data()[0], 5 - 1 + 10);
+    CHECK_EQ(c->data()[3], 32 - 4 + 16);
+
+    backward(sum(c));
+    CHECK_EQ(a->grad()[1], 6 - 1);
+    CHECK_EQ(b->grad()[2], 3 + 2);
+}
+
+TEST_CASE("tensor_broadcast") {
+    Tensor a = make_tensor({2, 3}, {1, 2, 3, 4, 5, 6});
+    Tensor row = make_tensor({3}, {10, 20, 30});
+    Tensor col = make_tensor({2, 1}, {100, 200});
+
+    Tensor c = a + row + col;
+    CHECK_EQ(c->shape(), Shape{2, 3});
+    CHECK_EQ(c->data()[0], 111);
+    CHECK_EQ(c->data()[5], 236);
+
+    backward(sum(c * a));
+    CHECK_EQ(row->grad()[0], 1 + 4);
+    CHECK_EQ(row->grad()[2], 3 + 6);
+    CHECK_EQ(col->grad()[1], 4 + 5 + 6);
+    // d/da (a + row + col) * a = 2a + row + col
+    CHECK_EQ(a->grad()[4], 2 * 5 + 20 + 200);
+
+    CHECK_THROWS_AS(a + make_tensor({2}, 0.0), std::invalid_argument);
+}
+
+TEST_CASE("tensor_matmul") {
+    Tensor a = make_tensor({2, 3}, {1, 2, 3, 4, 5, 6});
+    Tensor b = make_tensor({3, 2}, {7, 8, 9, 10, 11, 12});
+
+    Tensor c = matmul(a, b);
+    CHECK_EQ(c->shape(), Shape{2, 2});
+    CHECK_EQ(c->data()[0], 58);
+    CHECK_EQ(c->data()[1], 64);
+    CHECK_EQ(c->data()[2], 139);
+    CHECK_EQ(c->data()[3], 154);
+
+    // dA = dC * B^T and dB = A^T * dC with dC = 1.
+    Tensor total = sum(c);
+    backward(total);
+    CHECK_EQ(a->grad()[0], 7 + 8);
+    CHECK_EQ(a->grad()[5], 11 + 12);
+    CHECK_EQ(b->grad()[0], 1 + 4);
+    CHECK_EQ(b->grad()[5], 3 + 6);
+
+    // Running the same graph again doesn't propagate c's old gradient.
+    a->zero_grad();
+    backward(total);
+    CHECK_EQ(a->grad()[0], 7 + 8);
+
+    CHECK_THROWS_AS(matmul(a, a), std::invalid_argument);
+}
+
+TEST_CASE("tensor_reductions") {
+    Tensor a = make_tensor({2, 3}, {1, 2, 3, 4, 5, 6});
+
+    Tensor rows = sum(a, 1);
+    CHECK_EQ(rows->shape(), Shape{2});
+    CHECK_EQ(rows->data()[0], 6);
+    CHECK_EQ(rows->data()[1], 15);
+
+    Tensor cols = sum(a, 0);
+    CHECK_EQ(cols->shape(), Shape{3});
+    CHECK_EQ(cols->data()[2], 9);
+
+    Tensor m = mean(pow(a, 2));
+    CHECK(m->shape().empty());
+    CHECK_EQ_F(m->data()[0], 91.0 / 6);
+
+    backward(m);
+    CHECK_EQ_F(a->grad()[2], 2.0 * 3 / 6);
+
+    a->zero_grad();
+    backward(sum(rows * make_tensor({2}, {1, -1})));
+    CHECK_EQ(a->grad()[0], 1);
+    CHECK_EQ(a->grad()[4], -1);
+}
+
+TEST_CASE("tensor_activations") {
+    Tensor a = make_tensor({3}, {-1, 0.5, 2});
+
+    Tensor t = tanh(a);
+    Tensor r = relu(a);
+    CHECK_EQ_F(t->data()[1], std::tanh(0.5));
+    CHECK_EQ(r->data()[0], 0);
+    CHECK_EQ(r->data()[2], 2);
+
+    backward(sum(t + r));
+    CHECK_EQ_F(a->grad()[0], 1 - std::tanh(-1) * std::tanh(-1));
+    CHECK_EQ_F(a->grad()[2], 1 - std::tanh(2) * std::tanh(2) + 1);
+}
+
+TEST_CASE("tensor_mlp_train") {
+    Tensor X = make_tensor(
+        {4, 3}, {2.0, 3.0, -1.0, 3.0, -1.0, 0.5, 0.5, 1.0, 1.0, 1.0, 1.0, -1.0}
+    );
+    Tensor y = make_tensor({4, 1}, {1, -1, -1, 1});
+
+    Tensor_MLP mlp(3, {4, 4, 1});
+    double first = 0;
+    double last = 0;
+    for (int k = 0; k < 50; ++k) {
+        Tensor y_pred = mlp(X);
+        CHECK_EQ(y_pred->shape(), Shape{4, 1});
+        mlp.zero_grad();
+        Tensor loss = MSE_loss(y, y_pred);
+        backward(loss);
+        mlp.update(0.1);
+        (k == 0 ? first : last) = loss->data()[0];
+    }
+    CHECK(last < first);
+}
@@ -1,4 +1,6 @@
 #include <cmath>
+#include <sstream>
+#include <type_traits>
 #include "../src/value.hpp"
 #include "doctest.h"
 
@@ -241,3 +243,448 @@ TEST_CASE("value_grad_complex") {
     CHECK_EQ_F(y->get_grad(), std::exp(1 * (-2) * 3 + 9) * 1 * 3);
     CHECK_EQ_F(z->get_grad(), std::exp(1 * (-2) * 3 + 9) * (1 * (-2) + 2 * 3));
 }
+
+TEST_CASE("tape_grad") {
+    Value a = make_value(2);
+    Value b = make_value(3);
+    {
+        Tape tape;
+        Value c = a * b + exp(a);
+        CHECK_EQ(tape.size(), 3);
+        CHECK_EQ(Tape::current(), &tape);
+
+        backward(c);
+        CHECK_EQ_F(c->get_data(), 6 + std::exp(2));
+    }
+    CHECK_EQ(Tape::current(), nullptr);
+    CHECK_EQ_F(a->get_grad(), 3 + std::exp(2));
+    CHECK_EQ(b->get_grad(), 2);
+}
+
+TEST_CASE("value_node_layout") {
+    // Operands of n-ary ops, block state and labels live out of line.
+    CHECK_LE(sizeof(Value_handler), 96);
+    CHECK_LE(sizeof(Basic_value_handler<float>), 88);
+
+    Value a = make_value(2);
+    Value b = make_value(3);
+    Tape tape;
+    Value c = dot({a, b}, {b, a});
+    c->set_label("c");
+    a->set_label("a");
+    std::ostringstream os;
+    os << c << ' ' << a;
+    CHECK_EQ(os.str(), "(12 | 0 | c) (2 | 0 | a)");
+    backward(c);
+    CHECK_EQ(a->get_grad(), 6);
+}
+
+TEST_CASE("tape_nested") {
+    Value a = make_value(2);
+    Tape outer;
+    Value b = a * a;
+    {
+        Tape inner;
+        Value c = b * a;
+        CHECK_EQ(inner.size(), 1);
+        backward(c);
+    }
+    CHECK_EQ(Tape::current(), &outer);
+    CHECK_EQ(outer.size(), 1);
+    CHECK_EQ(a->get_grad(), 3 * 4);
+}
+
+TEST_CASE("topo_order_cached") {
+    Value a = make_value(2);
+    Value b = make_value(3);
+    Value c = a * b + a;
+
+    Topo_order order;
+    const std::vector<Value_handler *> &nodes = order.sort(c);
+    CHECK_EQ(nodes.size(), 2);
+    CHECK_EQ(nodes.back(), c.get());
+    CHECK_EQ(&order.sort(c), &nodes);
+    CHECK_EQ(order.sort(a).size(), 0);
+
+    backward(c, order);
+    CHECK_EQ(a->get_grad(), 3 + 1);
+    CHECK_EQ(b->get_grad(), 2);
+}
+
+TEST_CASE("topo_order_deep") {
+    Value a = make_value(1);
+    Value res = a;
+    for (int i = 0; i < 10000; ++i) {
+        res = res + a;
+    }
+    backward(res);
+    CHECK_EQ(res->get_data(), 10001);
+    CHECK_EQ(a->get_grad(), 10001);
+}
+
+TEST_CASE("value_tanh") {
+    Value a = make_value(0.5);
+
+    Value b = tanh(a);
+    CHECK_EQ_F(b->get_data(), std::tanh(0.5));
+    backward(b);
+    CHECK_EQ_F(a->get_grad(), 1 - std::tanh(0.5) * std::tanh(0.5));
+}
+
+TEST_CASE("value_log") {
+    Value a = make_value(4);
+
+    Value b = log(a);
+    CHECK_EQ_F(b->get_data(), std::log(4));
+    backward(b);
+    CHECK_EQ_F(a->get_grad(), 0.25);
+}
+
+TEST_CASE("value_sigmoid") {
+    Value a = make_value(2);
+
+    Value b = sigmoid(a);
+    double s = 1 / (1 + std::exp(-2));
+    CHECK_EQ_F(b->get_data(), s);
+    backward(b);
+    CHECK_EQ_F(a->get_grad(), s * (1 - s));
+}
+
+TEST_CASE("value_softplus") {
+    Value a = make_value(-1);
+
+    Value b = softplus(a);
+    CHECK_EQ_F(b->get_data(), std::log(1 + std::exp(-1)));
+    backward(b);
+    CHECK_EQ_F(a->get_grad(), 1 / (1 + std::exp(1)));
+
+    Value big = make_value(1000);
+    CHECK_EQ_F(softplus(big)->get_data(), 1000);
+}
+
+TEST_CASE("value_gelu") {
+    Value a = make_value(0.7);
+
+    Value b = gelu(a);
+    double cdf = 0.5 * (1 + std::erf(0.7 / std::sqrt(2)));
+    CHECK_EQ_F(b->get_data(), 0.7 * cdf);
+
+    // Compare against a central difference.
+    backward(b);
+    double h = 1e-6;
+    double numeric = (gelu(make_value(0.7 + h))->get_data() -
+                      gelu(make_value(0.7 - h))->get_data()) /
+                     (2 * h);
+    CHECK(std::abs(a->get_grad() - numeric) < 1e-7);
+}
+
+TEST_CASE("value_scalar_folding") {
+    Value a = make_value(3);
+    Value b = make_value(2);
+
+    Tape tape;
+    Value c = a - b;
+    Value d = a / 2;
+    Value e = 1 - a;
+    Value f = 2 * a + 1;
+    CHECK_EQ(tape.size(), 1 + 1 + 2 + 2);
+
+    CHECK_EQ(c->get_data(), 1);
+    CHECK_EQ(d->get_data(), 1.5);
+    CHECK_EQ(e->get_data(), -2);
+    CHECK_EQ(f->get_data(), 7);
+
+    backward(d * e * f);
+    CHECK_EQ_F(a->get_grad(), 0.5 * -2 * 7 + 1.5 * -1 * 7 + 1.5 * -2 * 2);
+    CHECK_EQ(b->get_grad(), 0);
+}
+
+TEST_CASE("value_grad_scalar") {
+    Value a = make_value(4);
+
+    backward(8 / a);
+    CHECK_EQ_F(a->get_grad(), -0.5);
+
+    a->zero_grad();
+    backward(-a - 3);
+    CHECK_EQ(a->get_grad(), -1);
+}
+
+TEST_CASE("value_dot") {
+    std::vector<Value> x = {make_value(1), make_value(-2), make_value(3)};
+    std::vector<Value> w = {make_value(0.5), make_value(4), make_value(-1)};
+    Value b = make_value(0.25);
+
+    Tape tape;
+    Value d = dot(x, w, b);
+    CHECK_EQ(tape.size(), 1);
+    CHECK_EQ(d->get_data(), 0.25 + 0.5 - 8 - 3);
+
+    backward(d);
+    for (size_t i = 0; i < x.size(); ++i) {
+        CHECK_EQ(x[i]->get_grad(), w[i]->get_data());
+        CHECK_EQ(w[i]->get_grad(), x[i]->get_data());
+    }
+    CHECK_EQ(b->get_grad(), 1);
+
+    CHECK_EQ(dot(x, w)->get_data(), 0.5 - 8 - 3);
+    CHECK_THROWS_AS(dot(x, {w[0]}), std::invalid_argument);
+}
+
+TEST_CASE("value_tanh_dot") {
+    std::vector<Value> x = {make_value(0.1), make_value(-0.2)};
+    std::vector<Value> w = {make_value(0.3), make_value(0.4)};
+    Value b = make_value(0.5);
+
+    Value fused = tanh_dot(x, w, b);
+    backward(fused);
+    std::vector<double> grads;
+    for (const Value &v : {x[0], x[1], w[0], w[1], b}) {
+        grads.push_back(v->get_grad());
+        v->zero_grad();
+    }
+
+    Value plain = tanh(x[0] * w[0] + x[1] * w[1] + b);
+    backward(plain);
+    CHECK_EQ_F(fused->get_data(), plain->get_data());
+    size_t i = 0;
+    for (const Value &v : {x[0], x[1], w[0], w[1], b}) {
+        CHECK_EQ_F(v->get_grad(), grads[i++]);
+    }
+}
+
+TEST_CASE("value_parameter_buffer") {
+    Value a;
+    {
+        std::vector<double> init = {1, 2, 3};
+        Parameter_buffer buffer(init);
+        CHECK_EQ(buffer.size(), 3);
+        a = buffer[0];
+        Value b = buffer[2];
+
+        backward(a * b);
+        CHECK_EQ(buffer.grad()[0], 3);
+        CHECK_EQ(buffer.grad()[2], 1);
+
+        buffer.update(0.5);
+        CHECK_EQ(a->get_data(), 1 - 0.5 * 3);
+        CHECK_EQ(buffer.data()[2], 3 - 0.5 * 1);
+        CHECK_EQ(buffer.data()[1], 2);
+
+        buffer.data()[1] = 7;
+        CHECK_EQ(buffer[1]->get_data(), 7);
+        buffer.zero_grad();
+        CHECK_EQ(a->get_grad(), 0);
+    }
+    // Handles keep the storage alive.
+    CHECK_EQ(a->get_data(), -0.5);
+}
+
+TEST_CASE("value_plan") {
+    Value x = make_value(0.7);
+    Value y = make_value(1.3);
+    Value w = make_value(-0.4);
+    auto build = [&w](const Value &a, const Value &b) {
+        Value c = a * b + w;
+        Value d = sigmoid(c) + gelu(a) * softplus(b) - relu(c) / exp(a);
+        Value e = tanh_dot({a, b, d}, {w, w, a}, w) + log(b) * pow(a, 3);
+        return std::vector<Value>{
+            e, dot({d, e}, {c, c}) - 2.0 / b, (-d) * 0.5 + tanh(c) - 1.0
+        };
+    };
+    std::vector<Value> inputs = {x, y};
+    Plan plan(inputs, build(x, y));
+    CHECK(plan.size() > 10);
+
+    for (double a : {0.2, -0.5, 1.5}) {
+        double b = 2 - a;
+        w->zero_grad();
+        std::vector<Value> in = {make_value(a), make_value(b)};
+        std::vector<Value> out = build(in[0], in[1]);
+        Value sum = out[0] + out[1] * 2.0 + out[2] * 3.0;
+        backward(sum);
+        double w_grad = w->get_grad();
+
+        w->zero_grad();
+        std::vector<double> input = {a, b};
+        std::vector<double> output_grad = {1, 2, 3};
+        plan.forward(input);
+        plan.backward(output_grad);
+        for (size_t it = 0; it < out.size(); ++it) {
+            CHECK_EQ_F(plan.output()[it], out[it]->get_data());
+        }
+        CHECK_EQ_F(plan.input_grad()[0], in[0]->get_grad());
+        CHECK_EQ_F(plan.input_grad()[1], in[1]->get_grad());
+        CHECK_EQ_F(w->get_grad(), w_grad);
+    }
+    CHECK_THROWS_AS(
+        plan.forward(std::vector<double>{1}), std::invalid_argument
+    );
+    CHECK_THROWS_AS(Plan({x * y}, {x}), std::invalid_argument);
+}
+
+namespace {
+
+// Left-deep chain of n nodes over w, like the sums of Neuron::operator().
+Value deep_chain(const Value &w, size_t n) {
+    Value res = w * 1.0;
+    for (size_t it = 1; it < n; ++it) {
+        res = it % 2 == 0 ? res + w : res * 0.5;
+    }
+    return res;
+}
+
+}  // namespace
+
+TEST_CASE("value_deep_graph_teardown") {
+    Value w = make_value(1.0);
+    Value root = deep_chain(w, 1'000'000);
+    // A shared inner node outlives the rest of the graph.
+    Value inner = deep_chain(w, 10) + 1.0;
+    Value outer = inner * root;
+    root = nullptr;
+    outer = nullptr;
+    CHECK_EQ(inner.use_count(), 1);
+    CHECK_EQ(w.use_count(), 6);
+
+    Tape tape;
+    Value taped = deep_chain(w, 1'000'000);
+    taped = nullptr;
+    CHECK_EQ(w.use_count(), 6);
+}
+
+TEST_CASE("value_huge_graph_teardown" * doctest::skip()) {
+    Value w = make_value(1.0);
+    Value root = deep_chain(w, 100'000'000);
+    root = nullptr;
+    CHECK_EQ(w.use_count(), 1);
+}
+
+TEST_CASE("value_requires_grad") {
+    Value x = make_constant(2);
+    Value y = make_constant(3);
+    Value w = make_value(0.5);
+    CHECK(!x->requires_grad());
+    CHECK(w->requires_grad());
+
+    // Constant-only subgraphs fold into childless constant leaves.
+    Value c = exp(x * y + 1.0) - dot({x}, {y}, y);
+    CHECK(!c->requires_grad());
+    CHECK_EQ_F(c->get_data(), std::exp(7.0) - 9);
+    CHECK_EQ(x.use_count(), 1);
+    CHECK_EQ(y.use_count(), 1);
+
+    Value loss = pow(w * x - y, 2) + tanh_dot({x, y}, {w, w}) * c;
+    CHECK(loss->requires_grad());
+    Topo_order order;
+    // pow, sub, mul, tanh_dot, mul and add; never the constants.
+    CHECK_EQ(order.sort(loss).size(), 6);
+    backward(loss, order);
+    double t = std::tanh(2.5);
+    CHECK_EQ_F(
+        w->get_grad(), 2 * (1.0 - 3) * 2 + c->get_data() * (1 - t * t) * 5
+    );
+
+    w->set_requires_grad(false);
+    CHECK(!(w * x)->requires_grad());
+    CHECK_THROWS_AS(Plan({w}, {w * 2.0}), std::invalid_argument);
+}
+
+TEST_CASE("value_retain_graph") {
+    Value a = make_value(2);
+    Value b = make_value(3);
+    Value kept = a * b;
+    std::weak_ptr<Value_handler> inner;
+    Value c = [&]() {
+        Value d = tanh(kept + a);
+        inner = d;
+        return d * b;
+    }();
+
+    backward(c, true);
+    backward(c, true);
+    double t = std::tanh(8.0);
+    CHECK_EQ_F(a->get_grad(), 2 * (1 - t * t) * (3 + 1) * 3);
+    CHECK(!inner.expired());
+
+    a->zero_grad();
+    b->zero_grad();
+    backward(c);
+    CHECK_EQ_F(a->get_grad(), (1 - t * t) * (3 + 1) * 3);
+    CHECK_EQ_F(b->get_grad(), (1 - t * t) * 2 * 3 + t);
+    // Nodes only the graph referenced are gone; nodes held elsewhere stay
+    // readable but can't run backward again.
+    CHECK(inner.expired());
+    CHECK_EQ(a.use_count(), 1);
+    CHECK_EQ_F(kept->get_data(), 6);
+    CHECK_EQ_F(c->get_data(), t * 3);
+    CHECK_THROWS_AS(backward(c), std::logic_error);
+    CHECK_THROWS_AS(backward(kept * 2.0), std::logic_error);
+    CHECK_THROWS_AS(Plan({a}, {kept}), std::logic_error);
+}
+
+namespace {
+
+// Tolerance of the tests run for both scalar types.
+template <typename T>
+constexpr double TOLERANCE = std::is_same_v<T, float> ? 1e-4 : 1e-9;
+
+template <typename T>
+std::vector<Basic_value<T>> scalar_graph(
+    const Basic_value<T> &a,
+    const Basic_value<T> &b
+) {
+    Basic_value<T> c = a * b + 0.5;
+    Basic_value<T> d = sigmoid(c) + gelu(a) * softplus(b) - relu(c) / exp(a);
+    Basic_value<T> e = tanh_dot<T>({a, b, d}, {b, b, a}, c) + log(b);
+    return {e * pow(a, 3), dot<T>({d, e}, {c, c}) - 2.0 / b, -tanh(d)};
+}
+
+}  // namespace
+
+TEST_CASE_TEMPLATE("value_scalar_types", T, float, double) {
+    static_assert(std::is_same_v<decltype(make_value<T>(1)->get_data()), T>);
+    Basic_value<T> a = make_value<T>(0.7);
+    Basic_value<T> b = make_value<T>(1.3);
+    std::vector<Basic_value<T>> out = scalar_graph(a, b);
+    Value ref_a = make_value(0.7);
+    Value ref_b = make_value(1.3);
+    std::vector<Value> ref = scalar_graph(ref_a, ref_b);
+
+    Basic_value<T> sum = out[0] + out[1] * 2.0 + out[2] * 3.0;
+    backward(sum, true);
+    a->zero_grad();
+    b->zero_grad();
+    backward(sum);
+    backward(ref[0] + ref[1] * 2.0 + ref[2] * 3.0);
+    for (size_t it = 0; it < out.size(); ++it) {
+        CHECK(std::abs(out[it]->get_data() - ref[it]->get_data()) <
+              TOLERANCE<T>);
+    }
+    CHECK(std::abs(a->get_grad() - ref_a->get_grad()) < TOLERANCE<T>);
+    CHECK(std::abs(b->get_grad() - ref_b->get_grad()) < TOLERANCE<T>);
+    CHECK_THROWS_AS(backward(sum), std::logic_error);
+
+    Basic_value<T> constant = make_constant<T>(2) * 3.0;
+    CHECK(!constant->requires_grad());
+    CHECK_EQ(constant->get_data(), T(6));
+
+    std::vector<T> init = {1, 2};
+    Basic_parameter_buffer<T> buffer(init);
+    Basic_value<T> x = make_value<T>(0);
+    Basic_value<T> y = make_value<T>(0);
+    Basic_plan<T> plan({x, y}, scalar_graph(buffer[0] * x, buffer[1] + y));
+    plan.forward(std::vector<T>{0.7, -0.7});
+    plan.backward(std::vector<T>{1, 2, 3});
+    for (size_t it = 0; it < out.size(); ++it) {
+        CHECK(std::abs(plan.output()[it] - out[it]->get_data()) <
+              TOLERANCE<T>);
+    }
+    CHECK(std::abs(plan.input_grad()[0] - a->get_grad()) < TOLERANCE<T>);
+    CHECK(std::abs(plan.input_grad()[1] - b->get_grad()) < TOLERANCE<T>);
+    CHECK(std::abs(buffer.grad()[0] - 0.7 * a->get_grad()) < TOLERANCE<T>);
+    CHECK(std::abs(buffer.grad()[1] - b->get_grad()) < TOLERANCE<T>);
+    buffer.update(0.5);
+    CHECK(std::abs(buffer.data()[1] - (2 - 0.5 * b->get_grad())) <
+          TOLERANCE<T>);
+}